@@ -24,45 +24,143 @@ static const Color TetrominoColors[] = {
 	{0, 255, 255} // cyan
 };
 
+const TetrominoShape TetrominoShapes[BLOCKS_NUM_TETROMINOES][BLOCKS_NUM_ROTATIONS] = {
+	{ // I
+		{1, 4, {0x1, 0x1, 0x1, 0x1}, {3}, {0}},
+		{4, 1, {0xf}, {0, 0, 0, 0}, {0, 0, 0, 0}},
+		{1, 4, {0x1, 0x1, 0x1, 0x1}, {3}, {0}},
+		{4, 1, {0xf}, {0, 0, 0, 0}, {0, 0, 0, 0}}
+	},
+	{ // J
+		{2, 3, {0x2, 0x2, 0x3}, {2, 2}, {2, 0}},
+		{3, 2, {0x1, 0x7}, {1, 1, 1}, {0, 1, 1}},
+		{2, 3, {0x3, 0x1, 0x1}, {2, 0}, {0, 0}},
+		{3, 2, {0x7, 0x4}, {0, 0, 1}, {0, 0, 0}}
+	},
+	{ // L
+		{2, 3, {0x1, 0x1, 0x3}, {2, 2}, {0, 2}},
+		{3, 2, {0x7, 0x1}, {1, 0, 0}, {0, 0, 0}},
+		{2, 3, {0x3, 0x2, 0x2}, {0, 2}, {0, 0}},
+		{3, 2, {0x4, 0x7}, {1, 1, 1}, {1, 1, 0}}
+	},
+	{ // O
+		{2, 2, {0x3, 0x3}, {1, 1}, {0, 0}},
+		{2, 2, {0x3, 0x3}, {1, 1}, {0, 0}},
+		{2, 2, {0x3, 0x3}, {1, 1}, {0, 0}},
+		{2, 2, {0x3, 0x3}, {1, 1}, {0, 0}}
+	},
+	{ // S
+		{3, 2, {0x6, 0x3}, {1, 1, 0}, {1, 0, 0}},
+		{2, 3, {0x1, 0x3, 0x2}, {1, 2}, {0, 1}},
+		{3, 2, {0x6, 0x3}, {1, 1, 0}, {1, 0, 0}},
+		{2, 3, {0x1, 0x3, 0x2}, {1, 2}, {0, 1}}
+	},
+	{ // Z
+		{3, 2, {0x3, 0x6}, {0, 1, 1}, {0, 0, 1}},
+		{2, 3, {0x2, 0x3, 0x1}, {2, 1}, {1, 0}},
+		{3, 2, {0x3, 0x6}, {0, 1, 1}, {0, 0, 1}},
+		{2, 3, {0x2, 0x3, 0x1}, {2, 1}, {1, 0}}
+	},
+	{ // T
+		{3, 2, {0x2, 0x7}, {1, 1, 1}, {1, 0, 1}},
+		{2, 3, {0x1, 0x3, 0x1}, {2, 1}, {0, 1}},
+		{3, 2, {0x7, 0x2}, {0, 1, 0}, {0, 0, 0}},
+		{2, 3, {0x2, 0x3, 0x2}, {1, 2}, {1, 0}}
+	}
+};
+
 /**
  * Print an error to stderr and exit with EXIT_FAILURE
  */
 static void blocksError(const char* message);
 
 /**
- * Generate a random tetromino
+ * Point the rows, skyline and pieces of a game at its own storage
+ */
+static void blocksFixPointers(BlocksGame *game);
+
+/**
+ * Generate a random tetromino type using the game's randomizer
+ */
+static enum TetrominoType blocksRandomType(BlocksGame *game);
+
+/**
+ * Take the first piece type from the preview queue and refill the queue
  */
-static Tetromino *blocksRandomTetromino(int gameWidth);
+static enum TetrominoType blocksTakePreview(BlocksGame *game);
 
 /**
- * Merge the old current piece into the game mask and cycle the new piece
+ * Spawn a tetromino of a given type at the top of the game
+ */
+static void blocksSpawnTetromino(Tetromino *piece, enum TetrominoType type, int gameWidth);
+
+/**
+ * Merge the old current piece into the game rows and cycle the new piece
  */
 static void blocksNextPiece(BlocksGame *game);
 
 /**
- * Check if there is a collision between the current piece and the game mask
+ * blocksNextPiece for a game of a given width, height and row words
+ */
+static inline __attribute__((always_inline)) void blocksNextPieceSized(BlocksGame *game, int width, int height, int words);
+
+/**
+ * blocksLandingRow for a game of a given width, height and row words
+ */
+static inline __attribute__((always_inline)) int blocksLandingRowSized(const BlocksGame *game, int width, int height, int words);
+
+/**
+ * Check if there is a collision between the current piece and the game rows
+ */
+static bool blocksCollision(const BlocksGame *game);
+
+/**
+ * Recompute the column heights of a game, scanning down from a row above the stack
  */
-static bool blocksCollision(BlocksGame *game);
+static void blocksUpdateSkyline(BlocksGame *game, int from);
 
 /**
- * Update game state (score, game over status, and cleared rows)
+ * blocksUpdateSkyline for a game of a given width, height and row words
  */
-static void blocksUpdateState(BlocksGame *game);
+static inline __attribute__((always_inline)) void blocksUpdateSkylineSized(BlocksGame *game, int from, int width, int height, int words);
 
 /**
- * Allocate a 2D byte mask
+ * Recompute the column heights of a wide game, scanning down from a row above the stack
  */
-static uint8_t **blocksAllocMask(int width, int height);
+static void blocksUpdateWideSkyline(BlocksGame *game, int from);
 
 /**
- * Free the memory used by an allocated byte mask
+ * Get the number of words each row of a game of a given width takes
  */
-static void blocksFreeMask(uint8_t **mask, int height);
+static inline int blocksRowWords(int width)
+{
+	return (width + BLOCKS_ROW_BITS - 1) / BLOCKS_ROW_BITS;
+}
 
 /**
- * Free the memory used by a tetromino
+ * Update game state (score, game over status, and cleared rows) of a game of a
+ * given width, height and row words after a piece covering rows top to
+ * bottom - 1 has been merged
  */
-static void blocksFreeTetromino(Tetromino *tetromino);
+static inline __attribute__((always_inline)) void blocksUpdateStateSized(BlocksGame *game, int top, int bottom, int width, int height, int words);
+
+/**
+ * Check if a game is the standard size
+ */
+static inline bool blocksStandard(const BlocksGame *game)
+{
+	return game->width == BLOCKS_STANDARD_WIDTH && game->height == BLOCKS_STANDARD_HEIGHT + BLOCKS_BUFFER_HEIGHT;
+}
+
+/**
+ * Call one of the always inlined ...Sized functions, whose last arguments are
+ * a game's width, height and row words, with constants for a standard game so
+ * it is compiled for that size alone (its loops over the columns unrolled and
+ * its wide game paths dropped), or else with the game's own
+ */
+#define BLOCKS_SPECIALIZE(game, function, ...) \
+	(blocksStandard(game) ? function(__VA_ARGS__, BLOCKS_STANDARD_WIDTH, BLOCKS_STANDARD_HEIGHT + BLOCKS_BUFFER_HEIGHT, 1) \
+	                      : function(__VA_ARGS__, (game)->width, (game)->height, (game)->row_words))
 
 static void blocksError(const char* message)
 {
@@ -70,110 +168,221 @@ static void blocksError(const char* message)
 	exit(EXIT_FAILURE);	
 }
 
+size_t blocksGameSize(int width, int height)
+{
+	return sizeof(BlocksGame) + (size_t) (height + BLOCKS_BUFFER_HEIGHT) * blocksRowWords(width) * sizeof(BlocksRow) +
+	       width * sizeof(int);
+}
+
+static void blocksFixPointers(BlocksGame *game)
+{
+	game->rows = (BlocksRow *) (game + 1);
+	game->skyline = (int *) (game->rows + (size_t) game->height * game->row_words);
+	game->current_piece = &game->pieces[0];
+	game->next_piece = &game->pieces[1];
+}
+
+BlocksGame *blocksCloneGame(const BlocksGame *game, void *storage)
+{
+	BlocksGame *clone = storage;
+	
+	memcpy(clone, game, game->size);
+	blocksFixPointers(clone);
+	
+	return clone;
+}
+
+size_t blocksStateSize(const BlocksGame *game)
+{
+	return game->size;
+}
+
+void blocksSaveState(const BlocksGame *game, void *state)
+{
+	memcpy(state, game, game->size);
+}
+
+void blocksRestoreState(BlocksGame *game, const void *state)
+{
+	if(((const BlocksGame *) state)->size != game->size)
+		blocksError("Restoring a Blocks3D game from a state of a different size.");
+	
+	memcpy(game, state, game->size);
+	blocksFixPointers(game);
+	
+	game->dirty = DIRTY_ALL;
+}
+
 BlocksGame *blocksNewGame(int width, int height)
 {
-	BlocksGame *game = malloc(sizeof(BlocksGame));
+	struct timespec now;
+	
+	clock_gettime(CLOCK_REALTIME, &now);
+	
+	return blocksNewGameSeeded(width, height, (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec, RANDOMIZER_UNIFORM);
+}
+
+BlocksGame *blocksNewGameSeeded(int width, int height, uint64_t seed, Randomizer randomizer)
+{
+	int i;
+	
+	if(width < BLOCKS_PIECE_SIZE || width > BLOCKS_MAX_WIDTH)
+		blocksError("Invalid width for a new Blocks3D game.");
+	
+	size_t size = blocksGameSize(width, height);
+	BlocksGame *game = calloc(1, size);
 	
 	if(!game)
 		blocksError("Error allocating memory for a new Blocks3D game.");
 	
+	game->size = size;
 	game->width = width;
 	game->height = height + BLOCKS_BUFFER_HEIGHT;
+	game->row_words = blocksRowWords(width);
+	
+	blocksFixPointers(game);
 	
-	game->mask = blocksAllocMask(game->width, game->height);
+	// the columns of the last word of a row, and for wide games the fastest
+	// kernels for whole rows
 	
-	srand(time(NULL));
-	game->current_piece = blocksRandomTetromino(game->width);
-	game->next_piece = blocksRandomTetromino(game->width);
+	int last_bits = width - (game->row_words - 1) * BLOCKS_ROW_BITS;
+	
+	game->full_row = last_bits == BLOCKS_ROW_BITS ? ~(BlocksRow) 0 : ((BlocksRow) 1 << last_bits) - 1;
+	game->row_kernels = game->row_words > 1 ? blocksRowKernels() : NULL;
+	
+	blocksUpdateSkyline(game, 0);
+	
+	blocksSeedRandom(&game->random, seed);
+	game->randomizer = randomizer;
+	game->bag_size = 0;
+	
+	for (i = 0; i < BLOCKS_PREVIEW_SIZE; i++)
+		game->preview[i] = blocksRandomType(game);
+	
+	game->preview_head = 0;
+	
+	blocksSpawnTetromino(game->current_piece, blocksTakePreview(game), game->width);
+	blocksSpawnTetromino(game->next_piece, blocksTakePreview(game), game->width);
 	
 	game->score = 0;
 	game->score_multiplier = 1;
 	game->game_over = false;
 	
+	game->pieces_placed = 0;
+	game->lines_cleared = 0;
+	
+	game->dirty = DIRTY_ALL;
+	
 	return game;
 }
 
-static Tetromino *blocksRandomTetromino(int gameWidth)
+void blocksSeedRandom(BlocksRandom *random, uint64_t seed)
 {
-	Tetromino *next_piece = malloc(sizeof(Tetromino));
+	int i;
 	
-	if(!next_piece)
-		blocksError("Error allocating memory for a new tetromino.");
+	// expand the seed with splitmix64 so that similar seeds give unrelated states
 	
-	int piece = rand() % 7;
-	switch(piece)
+	for (i = 0; i < 4; i++)
 	{
-		case TETROMINO_I:
-			next_piece->width = 1;
-			next_piece->height = 4;
-			next_piece->mask = blocksAllocMask(next_piece->width, next_piece->height);
-			next_piece->mask[0][0] = 1;
-			next_piece->mask[1][0] = 1;
-			next_piece->mask[2][0] = 1;
-			next_piece->mask[3][0] = 1;
-			break;
-		case TETROMINO_J:
-			next_piece->width = 2;
-			next_piece->height = 3;
-			next_piece->mask = blocksAllocMask(next_piece->width, next_piece->height);
-			next_piece->mask[0][1] = 1;
-			next_piece->mask[1][1] = 1;
-			next_piece->mask[2][1] = 1;
-			next_piece->mask[2][0] = 1;
-			break;
-		case TETROMINO_L:
-			next_piece->width = 2;
-			next_piece->height = 3;
-			next_piece->mask = blocksAllocMask(next_piece->width, next_piece->height);
-			next_piece->mask[0][0] = 1;
-			next_piece->mask[1][0] = 1;
-			next_piece->mask[2][0] = 1;
-			next_piece->mask[2][1] = 1;
-			break;
-		case TETROMINO_O:
-			next_piece->width = 2;
-			next_piece->height = 2;
-			next_piece->mask = blocksAllocMask(next_piece->width, next_piece->height);
-			next_piece->mask[0][0] = 1;
-			next_piece->mask[0][1] = 1;
-			next_piece->mask[1][0] = 1;
-			next_piece->mask[1][1] = 1;
-			break;
-		case TETROMINO_S:
-			next_piece->width = 3;
-			next_piece->height = 2;
-			next_piece->mask = blocksAllocMask(next_piece->width, next_piece->height);
-			next_piece->mask[0][1] = 1;
-			next_piece->mask[0][2] = 1;
-			next_piece->mask[1][0] = 1;
-			next_piece->mask[1][1] = 1;
-			break;
-		case TETROMINO_Z:
-			next_piece->width = 3;
-			next_piece->height = 2;
-			next_piece->mask = blocksAllocMask(next_piece->width, next_piece->height);
-			next_piece->mask[0][0] = 1;
-			next_piece->mask[0][1] = 1;
-			next_piece->mask[1][1] = 1;
-			next_piece->mask[1][2] = 1;
-			break;
-		case TETROMINO_T:
-			next_piece->width = 3;
-			next_piece->height = 2;
-			next_piece->mask = blocksAllocMask(next_piece->width, next_piece->height);
-			next_piece->mask[0][1] = 1;
-			next_piece->mask[1][0] = 1;
-			next_piece->mask[1][1] = 1;
-			next_piece->mask[1][2] = 1;
-			break;
+		uint64_t z = (seed += 0x9e3779b97f4a7c15);
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+		random->state[i] = z ^ (z >> 31);
+	}
+}
+
+uint64_t blocksRandomNext(BlocksRandom *random)
+{
+	uint64_t *s = random->state;
+	uint64_t result = s[1] * 5;
+	uint64_t t = s[1] << 17;
+	
+	result = ((result << 7) | (result >> 57)) * 9;
+	
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = (s[3] << 45) | (s[3] >> 19);
+	
+	return result;
+}
+
+uint32_t blocksRandomBelow(BlocksRandom *random, uint32_t bound)
+{
+	// multiply and shift, rejecting the few low products that would bias the result
+	
+	uint64_t product = (blocksRandomNext(random) >> 32) * bound;
+	uint32_t low = (uint32_t) product;
+	
+	if(low < bound)
+	{
+		uint32_t threshold = -bound % bound;
+		
+		while(low < threshold)
+		{
+			product = (blocksRandomNext(random) >> 32) * bound;
+			low = (uint32_t) product;
+		}
 	}
 	
-	next_piece->position[0] = gameWidth / 2 - 2;
-	next_piece->position[1] = BLOCKS_BUFFER_HEIGHT - next_piece->height;
+	return product >> 32;
+}
+
+static enum TetrominoType blocksRandomType(BlocksGame *game)
+{
+	int i;
+	
+	if(game->randomizer == RANDOMIZER_UNIFORM)
+		return blocksRandomBelow(&game->random, BLOCKS_NUM_TETROMINOES);
+	
+	// deal every type once from a shuffled bag before refilling it
+	
+	if(!game->bag_size)
+	{
+		for (i = 0; i < BLOCKS_NUM_TETROMINOES; i++)
+			game->bag[i] = i;
+		
+		game->bag_size = BLOCKS_NUM_TETROMINOES;
+	}
+	
+	i = blocksRandomBelow(&game->random, game->bag_size);
+	
+	enum TetrominoType type = game->bag[i];
+	game->bag[i] = game->bag[--game->bag_size];
+	
+	return type;
+}
+
+static enum TetrominoType blocksTakePreview(BlocksGame *game)
+{
+	enum TetrominoType type = game->preview[game->preview_head];
+	
+	game->preview[game->preview_head] = blocksRandomType(game);
+	game->preview_head = (game->preview_head + 1) % BLOCKS_PREVIEW_SIZE;
+	
+	return type;
+}
+
+enum TetrominoType blocksPreviewPiece(const BlocksGame *game, int n)
+{
+	if(n == 0)
+		return game->next_piece->type;
+	
+	return game->preview[(game->preview_head + n - 1) % BLOCKS_PREVIEW_SIZE];
+}
+
+static void blocksSpawnTetromino(Tetromino *piece, enum TetrominoType type, int gameWidth)
+{
+	piece->type = type;
+	piece->rotation = 0;
+	piece->shape = &TetrominoShapes[type][0];
 	
-	next_piece->color = TetrominoColors[piece];
+	piece->position[0] = gameWidth / 2 - 2;
+	piece->position[1] = BLOCKS_BUFFER_HEIGHT - piece->shape->height;
 	
-	return next_piece;
+	piece->color = TetrominoColors[type];
 }
 
 void blocksMovePiece(BlocksGame *game, Direction direction)
@@ -188,18 +397,25 @@ void blocksMovePiece(BlocksGame *game, Direction direction)
 		
 			if(blocksCollision(game))
 				game->current_piece->position[0]++;
+			else
+				game->dirty |= DIRTY_PIECE;
 			break;
 		case DIRECTION_RIGHT:
 			game->current_piece->position[0]++;
 			
 			if(blocksCollision(game))
 				game->current_piece->position[0]--;
+			else
+				game->dirty |= DIRTY_PIECE;
 			break;
 		case DIRECTION_DOWN:
 			game->current_piece->position[1]++;
 			
 			if(!blocksCollision(game))
+			{
+				game->dirty |= DIRTY_PIECE;
 				return;
+			}
 			
 			game->current_piece->position[1]--;
 			
@@ -208,15 +424,34 @@ void blocksMovePiece(BlocksGame *game, Direction direction)
 	}
 }
 
+void blocksApplyInput(BlocksGame *game, Input input)
+{
+	switch (input)
+	{
+		case INPUT_LEFT:
+			blocksMovePiece(game, DIRECTION_LEFT);
+			break;
+		case INPUT_RIGHT:
+			blocksMovePiece(game, DIRECTION_RIGHT);
+			break;
+		case INPUT_DOWN:
+			blocksMovePiece(game, DIRECTION_DOWN);
+			break;
+		case INPUT_ROTATE:
+			blocksRotatePiece(game);
+			break;
+		case INPUT_DROP:
+			blocksDropPiece(game);
+			break;
+	}
+}
+
 void blocksDropPiece(BlocksGame *game)
 {
 	if(game->game_over)
 		return;
 	
-	while(!blocksCollision(game))
-		game->current_piece->position[1]++;
-	
-	game->current_piece->position[1]--;
+	game->current_piece->position[1] = blocksLandingRow(game);
 
 	blocksNextPiece(game);
 }
@@ -226,32 +461,56 @@ static void blocksNextPiece(BlocksGame *game)
 	if(game->game_over)
 		return;
 	
-	int i, j;
+	BLOCKS_SPECIALIZE(game, blocksNextPieceSized, game);
+}
 
-	// merge old piece into game mask
+static inline __attribute__((always_inline)) void blocksNextPieceSized(BlocksGame *game, int width, int height, int words)
+{
+	int i;
+	Tetromino *piece = game->current_piece;
+	int top = piece->position[1];
+	int bottom = top + piece->shape->height;
+
+	// merge old piece into game rows, in a wide game into the word the piece
+	// starts in and the next one if it crosses into it
 	
-	for (i = 0; i < game->current_piece->height; i++)
+	if(words == 1)
 	{
-		int y = game->current_piece->position[1] + i;
+		for (i = 0; i < piece->shape->height; i++)
+			game->rows[top + i] |= piece->shape->mask[i] << piece->position[0];
+	}
+	else
+	{
+		BlocksRow *row = game->rows + (size_t) top * words + piece->position[0] / BLOCKS_ROW_BITS;
+		int bit = piece->position[0] % BLOCKS_ROW_BITS;
 		
-		for (j = 0; j < game->current_piece->width; j++)
+		for (i = 0; i < piece->shape->height; i++, row += words)
 		{
-			int x = game->current_piece->position[0] + j;
+			row[0] |= piece->shape->mask[i] << bit;
 			
-			if(game->current_piece->mask[i][j])
-				game->mask[y][x] = 1;
+			if(bit + piece->shape->width > BLOCKS_ROW_BITS)
+				row[1] |= piece->shape->mask[i] >> (BLOCKS_ROW_BITS - bit);
 		}
 	}
 	
+	for (i = 0; i < piece->shape->width; i++)
+	{
+		int x = piece->position[0] + i;
+		
+		if(top + piece->shape->top[i] < game->skyline[x])
+			game->skyline[x] = top + piece->shape->top[i];
+	}
+	
 	// cycle pieces
 	
-	blocksFreeTetromino(game->current_piece);
-	game->current_piece = game->next_piece;
-	game->next_piece = blocksRandomTetromino(game->width);
+	*game->current_piece = *game->next_piece;
+	blocksSpawnTetromino(game->next_piece, blocksTakePreview(game), game->width);
+	
+	game->dirty |= DIRTY_BOARD | DIRTY_PIECE | DIRTY_NEXT | DIRTY_SCORE;
 	
 	// update game state after each dropped piece
 	
-	blocksUpdateState(game);
+	blocksUpdateStateSized(game, top, bottom, width, height, words);
 }
 
 void blocksRotatePiece(BlocksGame *game)
@@ -259,171 +518,209 @@ void blocksRotatePiece(BlocksGame *game)
 	if(game->game_over)
 		return;
 	
-	int i, j;
-	uint8_t **old_mask;
-	
-	int new_width = game->current_piece->height;
-	int new_height = game->current_piece->width;
-	uint8_t **new_mask = blocksAllocMask(new_width, new_height);
+	Tetromino *piece = game->current_piece;
+	int old_rotation = piece->rotation;
 	
-	for(i = 0; i < new_height; i++)
-		for(j = 0; j < new_width; j++)
-			new_mask[i][j] = game->current_piece->mask[game->current_piece->height - j - 1][i];
-	
-	old_mask = game->current_piece->mask;
-	game->current_piece->mask = new_mask;
-	game->current_piece->height = new_height;
-	game->current_piece->width = new_width;
+	piece->rotation = (old_rotation + 1) % BLOCKS_NUM_ROTATIONS;
+	piece->shape = &TetrominoShapes[piece->type][piece->rotation];
 	
 	// if rotation causes a collision, undo it
 	
 	if(blocksCollision(game))
 	{
-		game->current_piece->mask = old_mask;
-		game->current_piece->height = new_width;
-		game->current_piece->width = new_height;
-		blocksFreeMask(new_mask, new_height);
-		
-		return;
+		piece->rotation = old_rotation;
+		piece->shape = &TetrominoShapes[piece->type][old_rotation];
 	}
-
-	blocksFreeMask(old_mask, new_width);
+	else
+		game->dirty |= DIRTY_PIECE;
 }
 
-static bool blocksCollision(BlocksGame *game)
+unsigned int blocksTakeDirty(BlocksGame *game)
 {
-	int i, j;
+	unsigned int dirty = game->dirty;
 	
-	// check for out of bounds
+	game->dirty = 0;
 	
-	if(game->current_piece->position[0] < 0)
-		return true;
-	
-	if(game->current_piece->position[0] + game->current_piece->width > game->width)
-		return true;
-	
-	if(game->current_piece->position[1] + game->current_piece->height > game->height)
-		return true;
+	return dirty;
+}
+
+int blocksLandingRow(const BlocksGame *game)
+{
+	return BLOCKS_SPECIALIZE(game, blocksLandingRowSized, game);
+}
+
+static inline __attribute__((always_inline)) int blocksLandingRowSized(const BlocksGame *game, int width, int height, int words)
+{
+	int i;
+	const Tetromino *piece = game->current_piece;
+	const TetrominoShape *shape = piece->shape;
+	int x = piece->position[0];
+	int y = piece->position[1];
+	int landing = height;
 	
-	// check for collisions
+	// the piece comes to rest where the first of its columns meets the stack
 	
-	for (i = 0; i < game->current_piece->height; i++)
+	for (i = 0; i < shape->width; i++)
 	{
-		int y = game->current_piece->position[1] + i;
+		int row = game->skyline[x + i] - 1 - shape->bottom[i];
 		
-		for (j = 0; j < game->current_piece->width; j++)
-		{
-			int x = game->current_piece->position[0] + j;
-			
-			if(game->current_piece->mask[i][j] && game->mask[y][x])
-				return true;
-		}
+		if(row < landing)
+			landing = row;
 	}
 	
-	return false;
+	if(landing >= y)
+		return landing;
+	
+	// the piece is below the top of the stack in some column (it was slid under
+	// an overhang), so step down from its current position instead
+	
+	while(!blocksShapeCollisionSized(game, shape, x, y + 1, width, height, words))
+		y++;
+	
+	return y;
 }
 
-static void blocksUpdateState(BlocksGame *game)
+static bool blocksCollision(const BlocksGame *game)
 {
-	int i, j, k;
+	const Tetromino *piece = game->current_piece;
+	
+	return blocksShapeCollision(game, piece->shape, piece->position[0], piece->position[1]);
+}
+
+static inline __attribute__((always_inline)) void blocksUpdateStateSized(BlocksGame *game, int top, int bottom, int width, int height, int words)
+{
+	int i;
+	int cleared = 0;
 	
 	// update score for landing piece
 	
 	game->score += game->score_multiplier * 100;
+	game->pieces_placed++;
 	
-	// check for full rows
+	// only the rows touched by the piece can have become full, so compact them
+	// in a single bottom up pass that skips the full ones, then move all rows
+	// above the piece down at once and empty the top rows
 	
-	for (i = 0; i < game->height; i++)
+	if(words > 1)
+		cleared = game->row_kernels->compact(game->rows, words, top, bottom, game->full_row);
+	else
 	{
-		// check for full row
+		int write = bottom - 1;
 		
-		bool full_row = true;
-		
-		for (j = 0; j < game->width; j++)
-			if(!game->mask[i][j])
-				full_row = false;
+		for (i = bottom - 1; i >= top; i--)
+		{
+			if(game->rows[i] == game->full_row)
+				cleared++;
+			else
+				game->rows[write--] = game->rows[i];
+		}
 		
-		if(full_row)
+		if(cleared)
 		{
-			// update score for full row
-			
-			game->score += game->score_multiplier * 1000;
-			
-			// clear row
-			
-			for (j = 0; j < game->width; j++)
-				game->mask[i][j] = 0;
-			
-			// move all rows above down
-			
-			for(k = i - 1; k >= 0; k--)
-			{
-				for (j = 0; j < game->width; j++)
-				{
-					if(game->mask[k][j])
-					{
-						game->mask[k + 1][j] = 1;
-						game->mask[k][j] = 0;
-					}
-				}
-			}
+			memmove(game->rows + cleared, game->rows, top * sizeof(BlocksRow));
+			memset(game->rows, 0, cleared * sizeof(BlocksRow));
 		}
 	}
 	
-	// check for game over
+	if(cleared)
+	{
+		// update score for full rows
+		
+		game->score += game->score_multiplier * 1000 * cleared;
+		game->lines_cleared += cleared;
+		
+		// nothing moved up, so the new column heights are found by scanning
+		// down from the highest column before the clear
+		
+		int highest = height;
+		
+		for (i = 0; i < width; i++)
+			if(game->skyline[i] < highest)
+				highest = game->skyline[i];
+		
+		blocksUpdateSkylineSized(game, highest, width, height, words);
+	}
 	
-	for (i = 0; i < BLOCKS_BUFFER_HEIGHT; i++)
-		for (j = 0; j < game->width; j++)
-			if(game->mask[i][j])
-				game->game_over = true;
+	// check for game over, only the remaining rows of the piece can have
+	// reached the buffer
+	
+	for (i = top + cleared; i < bottom && i < BLOCKS_BUFFER_HEIGHT; i++)
+		if(words > 1 ? !game->row_kernels->empty(game->rows + (size_t) i * words, words) : game->rows[i])
+			game->game_over = true;
+	
+	if(game->game_over)
+		game->dirty |= DIRTY_GAME_OVER;
+}
+
+static void blocksUpdateSkyline(BlocksGame *game, int from)
+{
+	BLOCKS_SPECIALIZE(game, blocksUpdateSkylineSized, game, from);
 }
 
-static uint8_t **blocksAllocMask(int width, int height)
+static inline __attribute__((always_inline)) void blocksUpdateSkylineSized(BlocksGame *game, int from, int width, int height, int words)
 {
-	int i, j;
+	int x, y;
+	BlocksRow remaining = game->full_row;
 	
-	uint8_t **mask = malloc(height * sizeof(uint8_t *));
-	const char *error_message = "Error allocating memory for a mask.";
+	if(words > 1)
+	{
+		blocksUpdateWideSkyline(game, from);
+		return;
+	}
+	
+	for (x = 0; x < width; x++)
+		game->skyline[x] = height;
 	
-	if(!mask)
-		blocksError(error_message);
+	// the first occupied cell met in each column is its top
 	
-	for(i = 0; i < height; i++)
+	for (y = from; y < height && remaining; y++)
 	{
-		mask[i] = malloc(width * sizeof(uint8_t *));
+		BlocksRow found = game->rows[y] & remaining;
+		remaining &= ~found;
 		
-		if(!mask[i])
-			blocksError(error_message);
-		
-		for (j = 0; j < width; j++)
-			mask[i][j] = 0;
+		for (; found; found &= found - 1)
+			game->skyline[__builtin_ctzll(found)] = y;
 	}
-	
-	return mask;
 }
 
-void blocksFreeGame(BlocksGame *game)
+static void blocksUpdateWideSkyline(BlocksGame *game, int from)
 {
-	blocksFreeTetromino(game->current_piece);
-	blocksFreeTetromino(game->next_piece);
-	blocksFreeMask(game->mask, game->height);
+	int x, y, w;
+	int words = game->row_words;
+	int unfound = words;
+	BlocksRow remaining[BLOCKS_MAX_ROW_WORDS];
 	
-	free(game);
-}
-
-static void blocksFreeTetromino(Tetromino *tetromino)
-{
-	blocksFreeMask(tetromino->mask, tetromino->height);
+	for (x = 0; x < game->width; x++)
+		game->skyline[x] = game->height;
+	
+	for (w = 0; w < words - 1; w++)
+		remaining[w] = ~(BlocksRow) 0;
+	
+	remaining[words - 1] = game->full_row;
+	
+	// as for a single word, until the top of every column of every word is found
 	
-	free(tetromino);
+	for (y = from; y < game->height && unfound; y++)
+	{
+		const BlocksRow *row = game->rows + (size_t) y * words;
+		
+		for (w = 0; w < words; w++)
+		{
+			BlocksRow found = row[w] & remaining[w];
+			
+			if(!found)
+				continue;
+			
+			remaining[w] &= ~found;
+			unfound -= !remaining[w];
+			
+			for (; found; found &= found - 1)
+				game->skyline[w * BLOCKS_ROW_BITS + __builtin_ctzll(found)] = y;
+		}
+	}
 }
 
-static void blocksFreeMask(uint8_t **mask, int height)
+void blocksFreeGame(BlocksGame *game)
 {
-	int i;
-	
-	for(i = 0; i < height; i++)
-		free(mask[i]);
-	
-	free(mask);
+	free(game);
 }
@@ -10,6 +10,7 @@
 #define _BLOCKS_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 /**
@@ -17,6 +18,56 @@
  */
 static const int BLOCKS_BUFFER_HEIGHT = 4;
 
+/**
+ * The maximum width of a blocks game
+ */
+static const int BLOCKS_MAX_WIDTH = 4096;
+
+/**
+ * The width of a row word, and the widest game whose rows fit in a single word.
+ * Wider games store each row as several words, which the engine supports but
+ * the move generator, computer player and mesh don't.
+ */
+#define BLOCKS_ROW_BITS 64
+static const int BLOCKS_NARROW_WIDTH = BLOCKS_ROW_BITS;
+
+/**
+ * The most words a row can take
+ */
+#define BLOCKS_MAX_ROW_WORDS (4096 / BLOCKS_ROW_BITS)
+
+/**
+ * The size of the standard game, which the engine is compiled for separately
+ * with the size as constants, other sizes taking the generic path
+ */
+#define BLOCKS_STANDARD_WIDTH 10
+#define BLOCKS_STANDARD_HEIGHT 20
+
+/**
+ * The maximum width and height of a tetromino
+ */
+#define BLOCKS_PIECE_SIZE 4
+
+/**
+ * A row bitmask, bit j is set if the cell in column j is occupied, or a word
+ * of a row of a wide game, bit j of word w being the cell in column 64w + j
+ */
+typedef uint64_t BlocksRow;
+
+/**
+ * Kernels working on whole rows of a wide game, picked for the CPU when a game
+ * is created (see blocksrows.c)
+ */
+typedef struct BlocksRowKernels {
+
+	const char *name;
+
+	bool (*full)(const BlocksRow *row, int words, BlocksRow last);
+	bool (*empty)(const BlocksRow *row, int words);
+	int (*compact)(BlocksRow *rows, int words, int top, int bottom, BlocksRow last);
+
+} BlocksRowKernels;
+
 /**
  * RGB color
  */
@@ -28,19 +79,6 @@ typedef struct Color {
 
 } Color;
 
-/**
- * Tetromino representation
- */
-typedef struct Tetromino
-{
-	Color color;
-	int width;
-	int height;
-	uint8_t **mask;
-	int position[2];
-	
-} Tetromino;
-
 /**
  * Tetromino type enum
  */
@@ -56,22 +94,122 @@ enum TetrominoType {
 };
 
 /**
- * Blocks game representation
+ * The number of tetromino types and rotations of each type
+ */
+#define BLOCKS_NUM_TETROMINOES 7
+#define BLOCKS_NUM_ROTATIONS 4
+
+/**
+ * The shape of a tetromino in one rotation, with the lowest and highest
+ * occupied row of each column
+ */
+typedef struct TetrominoShape
+{
+	int width;
+	int height;
+	BlocksRow mask[BLOCKS_PIECE_SIZE];
+	int8_t bottom[BLOCKS_PIECE_SIZE];
+	int8_t top[BLOCKS_PIECE_SIZE];
+	
+} TetrominoShape;
+
+/**
+ * The shapes of every tetromino type in every rotation, each rotation being a
+ * clockwise turn of the previous one about the top left corner
+ */
+extern const TetrominoShape TetrominoShapes[BLOCKS_NUM_TETROMINOES][BLOCKS_NUM_ROTATIONS];
+
+/**
+ * Tetromino representation
+ */
+typedef struct Tetromino
+{
+	Color color;
+	enum TetrominoType type;
+	int rotation;
+	const TetrominoShape *shape;
+	int position[2];
+	
+} Tetromino;
+
+/**
+ * The number of upcoming pieces after the next piece kept in a game's preview queue
+ */
+#define BLOCKS_PREVIEW_SIZE 6
+
+/**
+ * Seedable random number generator state (xoshiro256**)
+ */
+typedef struct BlocksRandom {
+
+	uint64_t state[4];
+
+} BlocksRandom;
+
+/**
+ * Piece randomizer enum
+ */
+typedef enum Randomizer {
+
+	RANDOMIZER_UNIFORM,
+	RANDOMIZER_BAG
+
+} Randomizer;
+
+/**
+ * Flags for the parts of a blocks game that have changed
+ */
+typedef enum BlocksDirty {
+
+	DIRTY_BOARD = 1 << 0,
+	DIRTY_PIECE = 1 << 1,
+	DIRTY_NEXT = 1 << 2,
+	DIRTY_SCORE = 1 << 3,
+	DIRTY_GAME_OVER = 1 << 4,
+	DIRTY_ALL = (1 << 5) - 1
+
+} BlocksDirty;
+
+/**
+ * Blocks game representation, stored in a single block of memory (the game
+ * followed by its rows and skyline) so it can be copied with memcpy. Each row
+ * takes row_words words, and full_row has the columns of its last word set.
  */
 typedef struct BlocksGame {
 
+	size_t size;
+	
 	int width;
 	int height;
 	
 	Tetromino *current_piece;
 	Tetromino *next_piece;
+	Tetromino pieces[2];
 	
-	uint8_t **mask;
+	BlocksRow *rows;
+	BlocksRow full_row;
+	int row_words;
+	const BlocksRowKernels *row_kernels;
+	
+	int *skyline;
 	
 	long score;
 	int score_multiplier;
 	bool game_over;
 	
+	long pieces_placed;
+	long lines_cleared;
+	
+	BlocksRandom random;
+	Randomizer randomizer;
+	uint8_t bag[BLOCKS_NUM_TETROMINOES];
+	int bag_size;
+	
+	uint8_t preview[BLOCKS_PREVIEW_SIZE];
+	int preview_head;
+	
+	unsigned int dirty;
+	
 } BlocksGame;
 
 /**
@@ -86,10 +224,62 @@ typedef enum Direction {
 } Direction;
 
 /**
- * Create a new blocks game
+ * Player input enum, covering every way the current piece can be moved
+ */
+typedef enum Input {
+	
+	INPUT_LEFT,
+	INPUT_RIGHT,
+	INPUT_DOWN,
+	INPUT_ROTATE,
+	INPUT_DROP
+
+} Input;
+
+/**
+ * Create a new blocks game seeded from the clock with a uniform randomizer
  */
 BlocksGame *blocksNewGame(int width, int height);
 
+/**
+ * Create a new blocks game whose pieces are generated from a seed
+ */
+BlocksGame *blocksNewGameSeeded(int width, int height, uint64_t seed, Randomizer randomizer);
+
+/**
+ * Get the number of bytes used by a blocks game of a given size
+ */
+size_t blocksGameSize(int width, int height);
+
+/**
+ * Copy a blocks game into caller provided storage of blocksGameSize bytes,
+ * aligned for a BlocksGame, without allocating. The clone must not be passed
+ * to blocksFreeGame.
+ */
+BlocksGame *blocksCloneGame(const BlocksGame *game, void *storage);
+
+/**
+ * Get the number of bytes needed to save the state of a blocks game
+ */
+size_t blocksStateSize(const BlocksGame *game);
+
+/**
+ * Save the whole state of a blocks game (board, pieces, score and random
+ * number generator) into caller provided storage of blocksStateSize bytes
+ */
+void blocksSaveState(const BlocksGame *game, void *state);
+
+/**
+ * Restore a blocks game from a state saved from a game of the same size
+ */
+void blocksRestoreState(BlocksGame *game, const void *state);
+
+/**
+ * Get the type of an upcoming piece, 0 being the next piece and
+ * BLOCKS_PREVIEW_SIZE the furthest one known
+ */
+enum TetrominoType blocksPreviewPiece(const BlocksGame *game, int n);
+
 /**
  * Attempt to move the current piece in a blocks game
  */
@@ -105,9 +295,122 @@ void blocksRotatePiece(BlocksGame *game);
  */
 void blocksDropPiece(BlocksGame *game);
 
+/**
+ * Apply a player input to a blocks game
+ */
+void blocksApplyInput(BlocksGame *game, Input input);
+
+/**
+ * Get the parts of a blocks game that have changed (BlocksDirty flags) since
+ * the last call, and clear them
+ */
+unsigned int blocksTakeDirty(BlocksGame *game);
+
+/**
+ * Get the row the current piece of a blocks game would land on if dropped
+ */
+int blocksLandingRow(const BlocksGame *game);
+
 /**
  * Free the memory used by a blocks game
  */
 void blocksFreeGame(BlocksGame *game);
 
+/**
+ * Get the row kernels games are created with on this CPU, the fastest it
+ * supports unless BLOCKS3D_ROW_KERNELS names one of avx2, sse2 or scalar,
+ * exiting with an error if it names any other or one the CPU doesn't support
+ */
+const BlocksRowKernels *blocksRowKernels();
+
+/**
+ * Seed a random number generator
+ */
+void blocksSeedRandom(BlocksRandom *random, uint64_t seed);
+
+/**
+ * Get the next 64 random bits from a random number generator
+ */
+uint64_t blocksRandomNext(BlocksRandom *random);
+
+/**
+ * Get an unbiased random number in the range [0, bound)
+ */
+uint32_t blocksRandomBelow(BlocksRandom *random, uint32_t bound);
+
+/**
+ * Check if there is a collision between a piece shape at column x and row y and
+ * a game of a given width, height (with its buffer) and row words, always
+ * inlined so a caller passing constants gets the checks for that size only
+ */
+static inline __attribute__((always_inline)) bool blocksShapeCollisionSized(const BlocksGame *game, const TetrominoShape *shape,
+                                                                            int x, int y, int width, int height, int words)
+{
+	int i;
+	
+	// check for out of bounds
+	
+	if(x < 0)
+		return true;
+	
+	if(x + shape->width > width)
+		return true;
+	
+	if(y + shape->height > height)
+		return true;
+	
+	// check for collisions, a word per row in a narrow game
+	
+	if(words == 1)
+	{
+		for (i = 0; i < shape->height; i++)
+			if((shape->mask[i] << x) & game->rows[y + i])
+				return true;
+		
+		return false;
+	}
+	
+	// and in a wide game against the word the piece starts in and the next one
+	// if it crosses into it
+	
+	const BlocksRow *row = game->rows + y * words + x / BLOCKS_ROW_BITS;
+	int bit = x % BLOCKS_ROW_BITS;
+	
+	for (i = 0; i < shape->height; i++, row += words)
+	{
+		if((shape->mask[i] << bit) & row[0])
+			return true;
+		
+		if(bit + shape->width > BLOCKS_ROW_BITS && (shape->mask[i] >> (BLOCKS_ROW_BITS - bit)) & row[1])
+			return true;
+	}
+	
+	return false;
+}
+
+/**
+ * Check if there is a collision between a piece shape at column x and row y and
+ * the game rows or bounds
+ */
+static inline bool blocksShapeCollision(const BlocksGame *game, const TetrominoShape *shape, int x, int y)
+{
+	return blocksShapeCollisionSized(game, shape, x, y, game->width, game->height, game->row_words);
+}
+
+/**
+ * Check if the cell at column x and row y of a blocks game is occupied
+ */
+static inline bool blocksCell(const BlocksGame *game, int x, int y)
+{
+	return (game->rows[y * game->row_words + (unsigned int) x / BLOCKS_ROW_BITS] >> ((unsigned int) x % BLOCKS_ROW_BITS)) & 1;
+}
+
+/**
+ * Check if the cell at column x and row y of a tetromino is occupied
+ */
+static inline bool blocksPieceCell(const Tetromino *piece, int x, int y)
+{
+	return (piece->shape->mask[y] >> x) & 1;
+}
+
 #endif /* _BLOCKS_H */
@@ -6,9 +6,12 @@
  * @author Timothy Cheeseman
  */
 
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #ifdef __APPLE__
 #include <OpenGL/gl.h>
@@ -18,11 +21,156 @@
 #include <GL/gl.h>
 #include <GL/glu.h>
 #include <GL/glut.h>
+#include <GL/freeglut_ext.h>
 #endif
 
 #include "blocks.h"
+#include "blocksai.h"
+#include "blocksloop.h"
+#include "blocksdraw.h"
+#include "blocksprofile.h"
+#include "blocksrender.h"
+#include "blockswell.h"
 #include "blocks3d.h"
 
+/**
+ * The title of the game
+ */
+static const char *Title = "Blocks 3D";
+
+/**
+ * The main window handle
+ */
+static int MainWindow;
+
+/**
+ * The game sub-window handle
+ */
+static int GameWindow;
+
+/**
+ * The next piece sub-window handle
+ */
+static int NextPieceWindow;
+
+/**
+ * The game data structure, only touched by the simulation thread while it runs
+ */
+static BlocksGame *Game;
+
+/**
+ * The 3D game, played instead of the game while it isn't NULL. It is only
+ * touched on the GLUT thread, its gravity due at WellFallDue, and its camera
+ * turned by the time played since WellStart.
+ */
+static BlocksWell *Well;
+static double WellStart;
+static double WellFallDue;
+
+/**
+ * The size of the 3D game
+ */
+#define WELL_WIDTH 5
+#define WELL_DEPTH 5
+#define WELL_HEIGHT 12
+
+/**
+ * Whether or not the game is paused, and when it was paused
+ */
+static bool Paused;
+static double PausedAt;
+
+/**
+ * The speed of the game (time in ms for a piece to drop one level)
+ */
+static int Speed;
+
+/**
+ * The fixed timestep loop simulating the game
+ */
+static BlocksLoop *Loop;
+
+/**
+ * The snapshots of the game the simulation thread publishes, and the one the
+ * windows are drawing
+ */
+static BlocksSnapshots *Snapshots;
+static const BlocksSnapshot *Snapshot;
+
+/**
+ * The simulation thread, whether it has been started, and whether it should
+ * keep running
+ */
+static pthread_t Simulation;
+static bool SimulationStarted;
+static atomic_bool SimulationRunning;
+
+/**
+ * The sizes of the main and game windows the main window is laid out with
+ */
+static int MainWindowHeight;
+static int GameWindowWidth;
+static int GameWindowHeight;
+
+/**
+ * The display list of the main window's static border and text, the display
+ * lists drawing each digit, and whether the static list is up to date
+ */
+static GLuint HudList;
+static GLuint HudDigits;
+static bool HudCompiled;
+
+/**
+ * The score last drawn in the main window and its text
+ */
+static long HudScore = -1;
+static char HudScoreText[11];
+
+/**
+ * The views drawing the game and next piece sub-windows
+ */
+static BlocksView *GameView;
+static BlocksView *NextPieceView;
+
+/**
+ * The number of frames the frame time is averaged over
+ */
+#define FRAME_SAMPLES 60
+
+/**
+ * The last game window frame times in ms and whether or not their average is shown
+ */
+static double FrameTimes[FRAME_SAMPLES];
+static long FrameCount;
+static bool ShowFrameTime;
+
+/**
+ * The computer player and whether or not it is playing the game
+ */
+static BlocksAI *AI;
+static atomic_bool Autoplay;
+
+/**
+ * The number of the computer player's inputs each tick
+ */
+static int AutoplaySpeed;
+
+/**
+ * The most ticks the simulation thread catches up on after a stall
+ */
+#define MAX_CATCH_UP 15
+
+/**
+ * The time in ms between checks for new snapshots, about one display refresh
+ */
+#define FRAME_INTERVAL 16
+
+/**
+ * The time in ms the scheduler's single timer is armed for (0 if it isn't)
+ */
+static double SchedulerDue;
+static int SchedulerGeneration;
+
 int main (int argc, char *argv[]) {
 	
 	glutInit(&argc, argv);
@@ -34,24 +182,34 @@ int main (int argc, char *argv[]) {
 	glutDisplayFunc(mainWindowDisplay);
 	glutReshapeFunc(mainWindowReshape);
 	glutKeyboardFunc(mainWindowKeyboard);
+	glutKeyboardUpFunc(mainWindowKeyboardUp);
+	glutIgnoreKeyRepeat(1);
 	glutReshapeWindow(640, 480);
 	
 	GameWindow = glutCreateSubWindow(MainWindow, 10, 10, 460, 460);
 	glutDisplayFunc(gameWindowDisplay);
 	glutReshapeFunc(gameWindowReshape);
 	glutKeyboardFunc(mainWindowKeyboard);
+	glutKeyboardUpFunc(mainWindowKeyboardUp);
 	glutReshapeWindow(460, 460);
 	
 	NextPieceWindow = glutCreateSubWindow(MainWindow, 495, 230, 130, 130);
 	glutDisplayFunc(nextPieceWindowDisplay);
 	glutReshapeFunc(nextPieceWindowReshape);
 	glutKeyboardFunc(mainWindowKeyboard);
+	glutKeyboardUpFunc(mainWindowKeyboardUp);
 	glutReshapeWindow(130, 130);
 	
 	initGL();
 	
+#ifdef BLOCKS_PROFILE
+	atexit(dumpProfile);
+#endif
+	
 	initGame(DIFFICULTY_EASY);
 	Game->game_over = true;
+	blocksLoopPublish(Loop, Snapshots);
+	refresh();
 	
 	glutMainLoop();
 	
@@ -77,27 +235,88 @@ void initGL()
 	glCullFace(GL_BACK);
 	glEnable(GL_DEPTH_TEST);
 	glDepthFunc(GL_LEQUAL);
+	
+	// draw the blocks with instancing when the GL supports it, unless immediate
+	// mode is asked for to compare the two
+	
+	bool instancing = false;
+	
+#ifndef __APPLE__
+	instancing = !getenv("BLOCKS3D_IMMEDIATE") && blocksLoadInstancing(getProcAddress);
+#endif
+	
+	// room for every cell of the 3D game and its buffer, more than the 10x20
+	// game and its buffer have
+	
+	glutSetWindow(GameWindow);
+	GameView = blocksNewView(instancing ? blocksNewInstanceRenderer(WELL_WIDTH * WELL_DEPTH * (WELL_HEIGHT + BLOCKS_BUFFER_HEIGHT)) : NULL);
+	GameView->draw_text = drawText;
+	
+	glutSetWindow(NextPieceWindow);
+	NextPieceView = blocksNewView(instancing ? blocksNewInstanceRenderer(BLOCKS_PIECE_SIZE * BLOCKS_PIECE_SIZE) : NULL);
+}
+
+void *getProcAddress(const char *name)
+{
+#ifdef __APPLE__
+	return NULL;
+#else
+	return (void *) glutGetProcAddress(name);
+#endif
 }
 
 void mainWindowDisplay()
+{
+	BLOCKS_PROFILE_BEGIN(PROFILE_MAIN_WINDOW);
+	
+	glutSetWindow(MainWindow);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	
+	if(!HudCompiled)
+		compileHud();
+	
+	glCallList(HudList);
+	
+	// draw score from the digit display lists, formatting it again only when
+	// it has changed
+	
+	long score = Well ? Well->score : Snapshot ? Snapshot->game->score : 0;
+	
+	if(score != HudScore)
+	{
+		snprintf(HudScoreText, sizeof(HudScoreText), "%010ld", score);
+		HudScore = score;
+	}
+	
+	glRasterPos2d(GameWindowWidth + 45, MainWindowHeight - GameWindowHeight - 14);
+	glListBase(HudDigits - '0');
+	glCallLists(strlen(HudScoreText), GL_UNSIGNED_BYTE, HudScoreText);
+	
+	glutSwapBuffers();
+	
+	BLOCKS_PROFILE_END(PROFILE_MAIN_WINDOW);
+}
+
+void compileHud()
 {
 	int i, j;
-	int mainWindowHeight;
-	int gameWindowWidth;
-	int gameWindowHeight;
 	
-	int num_instructions = 14;
 	const char *instructions[] = {
 		
 		"Controls:",
-		"",
 		"E - New Easy Game",
 		"N - New Normal Game",
 		"H - New Hard Game",
 		"V - New Very Hard Game",
+		"3 - New 3D Game",
 		"P - Pause/Unpause",
+		"I - Autoplay On/Off",
 		"Esc - Quit",
-		"",
+		""
+	};
+	
+	const char *piece_instructions[] = {
+		
 		"W - Rotate Piece",
 		"A - Move Piece Left",
 		"D - Move Piece Right",
@@ -105,80 +324,104 @@ void mainWindowDisplay()
 		"Spacebar - Drop Piece"
 	};
 	
+	const char *well_instructions[] = {
+		
+		"Z/X/C - Rotate Piece About X/Y/Z",
+		"A/D - Move Piece Left/Right",
+		"W/S - Move Piece Back/Forward",
+		"Spacebar - Drop Piece"
+	};
+	
+	// the piece controls of the 3D game take the place of the game's while it is played
+	
+	int num_instructions = sizeof(instructions) / sizeof(instructions[0]);
+	const char **controls = Well ? well_instructions : piece_instructions;
+	int num_controls = Well ? sizeof(well_instructions) / sizeof(well_instructions[0])
+	                        : sizeof(piece_instructions) / sizeof(piece_instructions[0]);
 	const char *next_piece_text = "Next Piece";
 	const char *score_text = "Score:";
-	char score_number[11] = "0000000000";
-	
-	glutSetWindow(GameWindow);	
-	gameWindowWidth = glutGet(GLUT_WINDOW_WIDTH);
-	gameWindowHeight = glutGet(GLUT_WINDOW_HEIGHT);
 	
 	glutSetWindow(MainWindow);
-	mainWindowHeight = glutGet(GLUT_WINDOW_HEIGHT);
 	
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	if(!HudList)
+	{
+		HudList = glGenLists(1);
+		HudDigits = glGenLists(10);
+		
+		// one list per digit for the score, each drawing the digit and
+		// advancing the raster position
+		
+		for (i = 0; i < 10; i++)
+		{
+			glNewList(HudDigits + i, GL_COMPILE);
+			glutBitmapCharacter(GLUT_BITMAP_TIMES_ROMAN_24, '0' + i);
+			glEndList();
+		}
+	}
+	
+	glNewList(HudList, GL_COMPILE);
 	
 	// draw game border
 	
 	glBegin(GL_QUADS);
-	glVertex2f(5, mainWindowHeight - gameWindowHeight - 15);
-	glVertex2f(gameWindowWidth + 15, mainWindowHeight - gameWindowHeight - 15);
-	glVertex2f(gameWindowWidth + 15, mainWindowHeight - 5);
-	glVertex2f(5, mainWindowHeight - 5);
+	glVertex2f(5, MainWindowHeight - GameWindowHeight - 15);
+	glVertex2f(GameWindowWidth + 15, MainWindowHeight - GameWindowHeight - 15);
+	glVertex2f(GameWindowWidth + 15, MainWindowHeight - 5);
+	glVertex2f(5, MainWindowHeight - 5);
 	glEnd();
 	
 	// draw game title
 	
-	glRasterPos2d(gameWindowWidth + 45, mainWindowHeight - 24);
+	glRasterPos2d(GameWindowWidth + 45, MainWindowHeight - 24);
 	
-	for(i = 0; i < strlen(Title); i++)
+	for(i = 0; Title[i]; i++)
 		glutBitmapCharacter(GLUT_BITMAP_TIMES_ROMAN_24, Title[i]);
 	
 	// draw game instructions
 	
-	for(i = 0; i < num_instructions; i++)
+	for(i = 0; i < num_instructions + num_controls; i++)
 	{
-		glRasterPos2d(gameWindowWidth + 50, mainWindowHeight - 34 - 10 * (i + 2));
+		const char *instruction = i < num_instructions ? instructions[i] : controls[i - num_instructions];
 		
-		for(j = 0; j < strlen(instructions[i]); j++)
-			glutBitmapCharacter(GLUT_BITMAP_TIMES_ROMAN_10, instructions[i][j]);
+		glRasterPos2d(GameWindowWidth + 50, MainWindowHeight - 34 - 10 * (i + 2));
+		
+		for(j = 0; instruction[j]; j++)
+			glutBitmapCharacter(GLUT_BITMAP_TIMES_ROMAN_10, instruction[j]);
 	}
 	
 	// draw next piece area
 	
-	glRasterPos2d(gameWindowWidth + 45, mainWindowHeight - 220);
+	glRasterPos2d(GameWindowWidth + 45, MainWindowHeight - 220);
 		
-	for(i = 0; i < strlen(next_piece_text); i++)
+	for(i = 0; next_piece_text[i]; i++)
 		glutBitmapCharacter(GLUT_BITMAP_TIMES_ROMAN_24, next_piece_text[i]);
 	
 	glBegin(GL_QUADS);
-	glVertex2f(gameWindowWidth + 30, mainWindowHeight - 225);
-	glVertex2f(gameWindowWidth + 170, mainWindowHeight - 225);
-	glVertex2f(gameWindowWidth + 170, mainWindowHeight - 365);
-	glVertex2f(gameWindowWidth + 30, mainWindowHeight - 365);
+	glVertex2f(GameWindowWidth + 30, MainWindowHeight - 225);
+	glVertex2f(GameWindowWidth + 170, MainWindowHeight - 225);
+	glVertex2f(GameWindowWidth + 170, MainWindowHeight - 365);
+	glVertex2f(GameWindowWidth + 30, MainWindowHeight - 365);
 	glEnd();
 	
-	// draw score
-	glRasterPos2d(gameWindowWidth + 70, mainWindowHeight - gameWindowHeight + 10);
-	
-	for(i = 0; i < strlen(score_text); i++)
-		glutBitmapCharacter(GLUT_BITMAP_TIMES_ROMAN_24, score_text[i]);
+	// draw score label
 	
-	if(Game)
-		snprintf(score_number, 11, "%010ld", Game->score);
+	glRasterPos2d(GameWindowWidth + 70, MainWindowHeight - GameWindowHeight + 10);
 	
-	glRasterPos2d(gameWindowWidth + 45, mainWindowHeight - gameWindowHeight - 14);
+	for(i = 0; score_text[i]; i++)
+		glutBitmapCharacter(GLUT_BITMAP_TIMES_ROMAN_24, score_text[i]);
 	
-	for(i = 0; i < strlen(score_number); i++)
-		glutBitmapCharacter(GLUT_BITMAP_TIMES_ROMAN_24, score_number[i]);
+	glEndList();
 	
-	glutSwapBuffers();
+	HudCompiled = true;
 }
 
 void mainWindowReshape(int width, int height)
 {	
 	glutSetWindow(MainWindow);
 	
+	MainWindowHeight = height;
+	HudCompiled = false;
+	
 	glViewport(0, 0, (GLsizei) width, (GLsizei) height);
 	
 	glMatrixMode(GL_PROJECTION);
@@ -190,11 +433,14 @@ void mainWindowReshape(int width, int height)
 
 void mainWindowKeyboard(unsigned char key, int x, int y)
 {
+	Input input;
+	WellInput well_input;
+	
 	switch(key)
 	{
 		case 'e':
 		case 'E':
-			if (Game && Game->game_over)
+			if (gameOver())
 			{
 				initGame(DIFFICULTY_EASY);
 				startGame();
@@ -202,7 +448,7 @@ void mainWindowKeyboard(unsigned char key, int x, int y)
 			break;
 		case 'n':
 		case 'N':
-			if (Game && Game->game_over)
+			if (gameOver())
 			{
 				initGame(DIFFICULTY_NORMAL);
 				startGame();
@@ -210,7 +456,7 @@ void mainWindowKeyboard(unsigned char key, int x, int y)
 			break;
 		case 'h':
 		case 'H':
-			if (Game && Game->game_over)
+			if (gameOver())
 			{
 				initGame(DIFFICULTY_HARD);
 				startGame();
@@ -218,196 +464,286 @@ void mainWindowKeyboard(unsigned char key, int x, int y)
 			break;
 		case 'v':
 		case 'V':
-			if (Game && Game->game_over)
+			if (gameOver())
 			{
 				initGame(DIFFICULTY_VERY_HARD);
 				startGame();
 			}
 			break;
+		case '3':
+			if (gameOver())
+			{
+				initWell();
+				startWell();
+			}
+			break;
 		case 'p':
 		case 'P':
-			if(Game && !Game->game_over)
+			if((Well || Snapshot) && !gameOver())
 			{
 				Paused = !Paused;
 				
-				if(!Paused)
+				if(Paused)
+				{
+					stopSimulation();
+					PausedAt = getTime();
+					schedule();
+				}
+				else if(Well)
+					startWell();
+				else
 					startGame();
 			}
 			break;
+		case 'i':
+		case 'I':
+			atomic_store(&Autoplay, !atomic_load(&Autoplay));
+			break;
+		case 'f':
+		case 'F':
+			ShowFrameTime = !ShowFrameTime;
+			glutPostWindowRedisplay(GameWindow);
+			break;
 		case 27: // escape key
+			stopSimulation();
+			saveReplay();
+			
 			if(Game && !Game->game_over)
 				blocksFreeGame(Game);
 			
+			if(Well)
+				blocksFreeWell(Well);
+			
 			exit(EXIT_SUCCESS);
 			break;
+		default:
+			// the 3D game's piece controls are applied at once, on this thread
+			
+			if(Well)
+			{
+				if(!Well->game_over && !Paused && wellKeyInput(key, &well_input))
+					blocksWellApplyInput(Well, well_input);
+				
+				break;
+			}
+			
+			// piece controls are queued with the time they were pressed and
+			// applied by the loop's next tick
+			
+			if(Snapshot && !Snapshot->game->game_over && !Paused && keyInput(key, &input))
+				blocksLoopPushInput(Loop, getTime(), input, true);
+			
+			return;
+	}
+	
+	refreshDirty();
+}
+
+void mainWindowKeyboardUp(unsigned char key, int x, int y)
+{
+	Input input;
+	
+	// releases are queued even while paused so held keys don't stay held
+	
+	if(Loop && keyInput(key, &input))
+		blocksLoopPushInput(Loop, getTime(), input, false);
+}
+
+bool keyInput(unsigned char key, Input *input)
+{
+	switch(key)
+	{
 		case 'w':
 		case 'W':
-			if(Game && !Game->game_over)
-				blocksRotatePiece(Game);
-			break;
+			*input = INPUT_ROTATE;
+			return true;
 		case 'a':
 		case 'A':
-			if(Game && !Game->game_over)
-				blocksMovePiece(Game, DIRECTION_LEFT);
-			break;
+			*input = INPUT_LEFT;
+			return true;
 		case 's':
 		case 'S':
-			if(Game && !Game->game_over)
-				blocksMovePiece(Game, DIRECTION_DOWN);
-			break;
+			*input = INPUT_DOWN;
+			return true;
 		case 'd':
 		case 'D':
-			if(Game && !Game->game_over)
-				blocksMovePiece(Game, DIRECTION_RIGHT);
-			break;
+			*input = INPUT_RIGHT;
+			return true;
 		case 32: // spacebar
-			if(Game && !Game->game_over)
-				blocksDropPiece(Game);
-			break;
+			*input = INPUT_DROP;
+			return true;
 		default:
-			return;
+			return false;
+	}
+}
+
+bool wellKeyInput(unsigned char key, WellInput *input)
+{
+	switch(key)
+	{
+		case 'z':
+		case 'Z':
+			*input = WELL_INPUT_ROTATE_X;
+			return true;
+		case 'x':
+		case 'X':
+			*input = WELL_INPUT_ROTATE_Y;
+			return true;
+		case 'c':
+		case 'C':
+			*input = WELL_INPUT_ROTATE_Z;
+			return true;
+		case 'a':
+		case 'A':
+			*input = WELL_INPUT_LEFT;
+			return true;
+		case 'd':
+		case 'D':
+			*input = WELL_INPUT_RIGHT;
+			return true;
+		case 'w':
+		case 'W':
+			*input = WELL_INPUT_BACK;
+			return true;
+		case 's':
+		case 'S':
+			*input = WELL_INPUT_FORWARD;
+			return true;
+		case 32: // spacebar
+			*input = WELL_INPUT_DROP;
+			return true;
+		default:
+			return false;
 	}
-	
-	refresh();
 }
 
 void gameWindowDisplay()
 {
-	int i, j;
-	const char * game_over_text = "Game Over!";
+	double start = getTime();
+	
+	BLOCKS_PROFILE_BEGIN(PROFILE_GAME_WINDOW);
 	
 	glutSetWindow(GameWindow);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 	
-	if(Game)
-	{
+	// a paused game is drawn as it was at its last tick, and a paused 3D game
+	// as it was when paused
 	
-		glLoadIdentity();
-		gluLookAt(-2.0, 2.0, 10.0, 0.0, 0.0, 0.0, 0.0, 1.0, 0.0);
-		glRotated(Rotation[0], 1.0, 0.0, 0.0);
-		glRotated(Rotation[1], 0.0, 1.0, 0.0);
-		
-		// draw boundaries
-		
-		glColor3ub(0, 0, 255);
-		
-		glPushMatrix();
-		glTranslatef(0.0, 5.0, 0.0);
-		glScalef(Game->width, Game->height - BLOCKS_BUFFER_HEIGHT, 1.0);
-		
-		glutWireCube(10.0);
-		glPopMatrix();
+	if(Well)
+		blocksDrawWell(GameView, Well, (Paused ? PausedAt : start) - WellStart);
+	else if(Snapshot)
+		blocksDrawGame(GameView, Snapshot, Paused ? Snapshot->tick_start : start);
 	
-		// draw blocks
+	if(ShowFrameTime)
+		drawFrameTime();
 	
-		for (i = BLOCKS_BUFFER_HEIGHT; i < Game->height; i++)
-		{
-			for (j = 0; j < Game->width; j++)
-			{
-				glPushMatrix();
-				glTranslatef(-45.0 + 10.0 * j, Game->height * 10.0 - 100.0 - 10.0 * i, 0.0);
-				
-				if(Game->mask[i][j])
-				{
-					glColor3ub(255, 255, 255);
-					glutSolidCube(10.0);
-					
-					glColor3ub(0, 0, 0);
-					glutWireCube(10.0);	
-				}
-				
-				glPopMatrix();
-			}
-		}
+	glutSwapBuffers();
+	
+	FrameTimes[FrameCount++ % FRAME_SAMPLES] = getTime() - start;
+	
+	BLOCKS_PROFILE_END(PROFILE_GAME_WINDOW);
+}
+
+void drawText(const char *text)
+{
+	int i;
+	
+	for(i = 0; text[i]; i++)
+		glutBitmapCharacter(GLUT_BITMAP_TIMES_ROMAN_24, text[i]);
+}
+
+void drawFrameTime()
+{
+	int i;
+	char text[64];
+	double total = 0.0;
+	int samples = FrameCount < FRAME_SAMPLES ? FrameCount : FRAME_SAMPLES;
+	
+	for (i = 0; i < samples; i++)
+		total += FrameTimes[i];
+	
+	snprintf(text, sizeof(text), "%.2f ms/frame (%s)", samples ? total / samples : 0.0,
+	         GameView->instances ? "instanced" : "immediate");
+	
+	glLoadIdentity();
+	glColor3ub(255, 255, 0);
+	glRasterPos3d(-120.0, -120.0, 200.0);
+	
+	for (i = 0; text[i]; i++)
+		glutBitmapCharacter(GLUT_BITMAP_HELVETICA_12, text[i]);
+	
+#ifdef BLOCKS_PROFILE
+	// the rolling statistics of every timer above the average, last timer lowest
+	
+	BlocksTimerStats stats;
+	int timer, j;
+	
+	for (timer = 0; timer < PROFILE_NUM_TIMERS; timer++)
+	{
+		blocksProfileStats(timer, &stats);
+		snprintf(text, sizeof(text), "%-18s p50 %6.3f  p99 %6.3f  max %6.3f ms", blocksProfileName(timer),
+		         stats.p50, stats.p99, stats.max);
 		
-		// draw piece
-		for (i = 0; i < Game->current_piece->height; i++)
-		{
-			int y = Game->current_piece->position[1] + i;
-			
-			for (j = 0; j < Game->current_piece->width; j++)
-			{
-				int x = Game->current_piece->position[0] + j;
-				
-				glPushMatrix();
-				glTranslatef(-45.0 + 10.0 * x, Game->height * 10.0 - 100.0 - 10.0 * y, 0.0);
-				
-				if(Game->current_piece->mask[i][j] && y >= BLOCKS_BUFFER_HEIGHT)
-				{
-					glColor3ub(Game->current_piece->color.r, Game->current_piece->color.g, Game->current_piece->color.b);
-					glutSolidCube(10.0);
-					
-					glColor3ub(0, 0, 0);
-					glutWireCube(10.0);	
-				}
-				
-				glPopMatrix();
-			}
-		}
+		glRasterPos3d(-120.0, -120.0 + 8.0 * (PROFILE_NUM_TIMERS - timer), 200.0);
 		
-		if(Game->game_over)
-		{
-			glLoadIdentity();
-			glColor3ub(255, 0, 0);
-			glRasterPos3d(-30.0, 0.0, 200.0);
-			
-			for(i = 0; i < strlen(game_over_text); i++)
-				glutBitmapCharacter(GLUT_BITMAP_TIMES_ROMAN_24, game_over_text[i]);
-		}
+		for (j = 0; text[j]; j++)
+			glutBitmapCharacter(GLUT_BITMAP_HELVETICA_12, text[j]);
 	}
+#endif
+}
+
+#ifdef BLOCKS_PROFILE
+void dumpProfile()
+{
+	const char *path = getenv("BLOCKS3D_PROFILE");
 	
-	glutSwapBuffers();
+	if(!path)
+		path = "blocks3d-profile.csv";
+	
+	if(!blocksProfileDump(path))
+		fprintf(stderr, "BLOCKS3D: Error writing the profile to %s.\n", path);
+}
+#endif
+
+double getTime()
+{
+	struct timespec now;
+	
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	
+	return now.tv_sec * 1e3 + now.tv_nsec * 1e-6;
 }
 
 void gameWindowReshape(int width, int height)
 {
 	glutSetWindow(GameWindow);
 	
-	glViewport(0, 0, (GLsizei) width, (GLsizei) height);
+	// the main window's border and text are laid out around the game window
 	
-	glMatrixMode(GL_PROJECTION);
-	glLoadIdentity();
-	glOrtho(-125.0, 125.0, -125.0, 125.0, -200.0, 200.0);
+	GameWindowWidth = width;
+	GameWindowHeight = height;
+	HudCompiled = false;
+	glutPostWindowRedisplay(MainWindow);
 	
-	glMatrixMode(GL_MODELVIEW);
+	glViewport(0, 0, (GLsizei) width, (GLsizei) height);
+	blocksGameProjection();
 }
 
 void nextPieceWindowDisplay()
 {
-	int i, j;
+	BLOCKS_PROFILE_BEGIN(PROFILE_NEXT_PIECE_WINDOW);
 	
 	glutSetWindow(NextPieceWindow);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 	
-	if(Game && !Game->game_over)
-	{
-		glLoadIdentity();
-		gluLookAt(-2.0, 2.0, 10.0, 0.0, 0.0, 0.0, 0.0, 1.0, 0.0);
-		
-		for (i = 0; i < Game->next_piece->height; i++)
-		{
-			for (j = 0; j < Game->next_piece->width; j++)
-			{
-				glPushMatrix();
-				glTranslatef(-(Game->next_piece->width / 2.0) + 0.5 + 1.0 * j,
-							 (Game->next_piece->height / 2.0) - 0.5 - 1.0 * i,
-							 0.0);
-				
-				if(Game->next_piece->mask[i][j])
-				{
-					glColor3ub(Game->next_piece->color.r, Game->next_piece->color.g, Game->next_piece->color.b);
-					glutSolidCube(1.0);
-					
-					glColor3ub(0, 0, 0);
-					glutWireCube(1.0);	
-				}
-				
-				glPopMatrix();
-			}
-		}
-	}
+	if(Well)
+		blocksDrawWellNextPiece(NextPieceView, Well);
+	else if(Snapshot)
+		blocksDrawNextPiece(NextPieceView, Snapshot->game);
 	
 	glutSwapBuffers();
+	
+	BLOCKS_PROFILE_END(PROFILE_NEXT_PIECE_WINDOW);
 }
 
 void nextPieceWindowReshape(int width, int height)
@@ -415,86 +751,323 @@ void nextPieceWindowReshape(int width, int height)
 	glutSetWindow(NextPieceWindow);
 	
 	glViewport(0, 0, (GLsizei) width, (GLsizei) height);
-	
-	glMatrixMode(GL_PROJECTION);
-	glLoadIdentity();
-	glOrtho(-2.5, 2.5, -2.5, 2.5, -100.0, 100.0);
-	
-	glMatrixMode(GL_MODELVIEW);
+	blocksNextPieceProjection();
 }
 
 void refresh()
 {
+	bool fresh;
+	
+	Snapshot = blocksReadSnapshot(Snapshots, &fresh);
+	
 	glutPostWindowRedisplay(MainWindow);
 	glutPostWindowRedisplay(GameWindow);
 	glutPostWindowRedisplay(NextPieceWindow);
 }
 
+void refreshDirty()
+{
+	bool fresh;
+	unsigned int dirty;
+	
+	// the 3D game is played on this thread, so what changed is taken from it
+	// rather than from a snapshot
+	
+	if(Well)
+		dirty = blocksWellTakeDirty(Well);
+	else
+	{
+		Snapshot = blocksReadSnapshot(Snapshots, &fresh);
+		
+		if(!fresh)
+			return;
+		
+		dirty = Snapshot->dirty;
+	}
+	
+	if(dirty & (DIRTY_BOARD | DIRTY_PIECE | DIRTY_GAME_OVER))
+		glutPostWindowRedisplay(GameWindow);
+	
+	if(dirty & (DIRTY_NEXT | DIRTY_GAME_OVER))
+		glutPostWindowRedisplay(NextPieceWindow);
+	
+	// the score is the only part of the main window that changes
+	
+	if(dirty & DIRTY_SCORE)
+		glutPostWindowRedisplay(MainWindow);
+}
+
 void initGame(Difficulty difficulty)
 {
+	struct timespec now;
+	
+	stopSimulation();
+	saveReplay();
+	
 	if(Game)
 		blocksFreeGame(Game);
 	
-	Game = blocksNewGame(10, 20);
+	// a new game replaces the 3D game, and its controls in the main window
+	
+	if(Well)
+	{
+		blocksFreeWell(Well);
+		Well = NULL;
+		HudCompiled = false;
+	}
+	
+	// the seed is kept for recording the game
+	
+	clock_gettime(CLOCK_REALTIME, &now);
+	uint64_t seed = (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+	
+	Game = blocksNewGameSeeded(BLOCKS_STANDARD_WIDTH, BLOCKS_STANDARD_HEIGHT, seed, RANDOMIZER_UNIFORM);
+	blocksResetView(GameView);
 	Paused = 0;
 	Speed = 1000;
 	
 	switch (difficulty) {
 		case DIFFICULTY_EASY:
-			RotationDelta[0] = 0.0;
-			RotationDelta[1] = 0.0;
+			GameView->rotation_delta[0] = 0.0;
+			GameView->rotation_delta[1] = 0.0;
 			Game->score_multiplier = 1;
 			break;
 		case DIFFICULTY_NORMAL:
-			RotationDelta[0] = 0.0;
-			RotationDelta[1] = 1.0;
+			GameView->rotation_delta[0] = 0.0;
+			GameView->rotation_delta[1] = 1.0;
 			Game->score_multiplier = 2;
 			break;
 		case DIFFICULTY_HARD:
-			RotationDelta[0] = 1.0;
-			RotationDelta[1] = 0.0;
+			GameView->rotation_delta[0] = 1.0;
+			GameView->rotation_delta[1] = 0.0;
 			Game->score_multiplier = 3;
 			break;
 		case DIFFICULTY_VERY_HARD:
-			RotationDelta[0] = 1.0;
-			RotationDelta[1] = 1.0;
+			GameView->rotation_delta[0] = 1.0;
+			GameView->rotation_delta[1] = 1.0;
 			Game->score_multiplier = 4;
 			break;
 	};
 	
-	Rotation[0] = 0.0;
-	Rotation[1] = 0.0;
-	RotationSpeed = 50;
+	GameView->rotation_speed = 50;
+	
+	if(!AI)
+		AI = blocksNewAI(Game->width, Game->height - BLOCKS_BUFFER_HEIGHT, 8, 0);
+	
+	AutoplaySpeed = 2;
+	
+	if(Loop)
+	{
+		if(Loop->recorder)
+			blocksFreeRecorder(Loop->recorder);
+		
+		blocksFreeLoop(Loop);
+	}
+	
+	Loop = blocksNewLoop(Game, BLOCKS_TICK_RATE, getTime());
+	Loop->gravity = Loop->tick_length / Speed;
+	Loop->on_tick = gameTick;
+	
+	if(getenv("BLOCKS3D_REPLAY"))
+		Loop->recorder = blocksNewRecorder(Game, seed, BLOCKS_TICK_RATE);
+	
+	// the windows keep drawing the old snapshot until the new one is read
+	
+	if(Snapshots)
+		blocksFreeSnapshots(Snapshots);
+	
+	Snapshots = blocksNewSnapshots(Loop);
+	Snapshot = NULL;
 }
 
 void startGame()
 {
+	// ticks start again from now rather than catching up on the pause
+	
+	blocksLoopRebase(Loop, getTime());
+	
 	refresh();
+	schedule();
+	startSimulation();
+}
+
+void initWell()
+{
+	struct timespec now;
 	
-	glutTimerFunc(Speed, gameTimer, 0);
-	glutTimerFunc(RotationSpeed, rotationTimer, 0);
+	stopSimulation();
+	saveReplay();
+	
+	if(Well)
+		blocksFreeWell(Well);
+	
+	clock_gettime(CLOCK_REALTIME, &now);
+	
+	Well = blocksNewWell(WELL_WIDTH, WELL_DEPTH, WELL_HEIGHT, (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec);
+	blocksResetView(GameView);
+	HudCompiled = false;
+	Paused = 0;
+	Speed = 1000;
+	
+	// the camera only looks down into the well, so the 3D game is played from
+	// the easy game's view
+	
+	GameView->rotation_delta[0] = 0.0;
+	GameView->rotation_delta[1] = 0.0;
+	GameView->rotation_speed = 50;
+	
+	// the clocks start stopped, as if paused, until the game is started
+	
+	WellStart = PausedAt = getTime();
+	WellFallDue = WellStart + Speed;
 }
 
-void gameTimer(int value)
+void startWell()
 {
-	if(Paused || Game->game_over)
-		return;
+	double now = getTime();
+	
+	// gravity and the camera start again from now rather than catching up on
+	// the pause
+	
+	WellStart += now - PausedAt;
+	WellFallDue += now - PausedAt;
 	
-	blocksMovePiece(Game, DIRECTION_DOWN);
 	refresh();
+	schedule();
+}
+
+bool gameOver()
+{
+	if(Well)
+		return Well->game_over;
+	
+	return Snapshot && Snapshot->game->game_over;
+}
+
+void startSimulation()
+{
+	atomic_store(&SimulationRunning, true);
+	
+	if(pthread_create(&Simulation, NULL, simulationThread, NULL))
+	{
+		fprintf(stderr, "BLOCKS3D: Error creating the simulation thread.\n");
+		exit(EXIT_FAILURE);
+	}
 	
-	glutTimerFunc(Speed, gameTimer, 0);
+	SimulationStarted = true;
 }
 
-void rotationTimer(int value)
+void stopSimulation()
 {
-	if(Paused)
+	if(!SimulationStarted)
 		return;
 	
-	Rotation[0] += RotationDelta[0];
-	Rotation[1] += RotationDelta[1];
+	atomic_store(&SimulationRunning, false);
+	pthread_join(Simulation, NULL);
 	
-	refresh();
+	SimulationStarted = false;
+}
+
+void *simulationThread(void *data)
+{
+	double delay;
+	struct timespec sleep;
+	
+	// tick until the game is over or the thread is stopped, sleeping until
+	// each tick is due so rendering never holds up gravity
+	
+	while(atomic_load(&SimulationRunning) && !Game->game_over)
+	{
+		delay = blocksLoopNextTick(Loop) - getTime();
+		
+		if(delay > 0.0)
+		{
+			sleep.tv_sec = (time_t) (delay / 1e3);
+			sleep.tv_nsec = (long) ((delay - sleep.tv_sec * 1e3) * 1e6);
+			nanosleep(&sleep, NULL);
+		}
+		
+		if(blocksLoopAdvance(Loop, getTime(), MAX_CATCH_UP))
+			blocksLoopPublish(Loop, Snapshots);
+	}
+	
+	return NULL;
+}
+
+void schedule()
+{
+	double due = 0.0;
+	
+	// check for snapshots while the game runs (or move the 3D game's piece
+	// down), and redraw while the camera turns
+	
+	if((Well || Snapshot) && !Paused && (!gameOver() || GameView->rotation_delta[0] || GameView->rotation_delta[1]))
+		due = getTime() + FRAME_INTERVAL;
+	
+	// an armed timer is superseded by changing the generation, so it returns
+	// without rearming when it fires
+	
+	if(!due)
+	{
+		SchedulerDue = 0.0;
+		SchedulerGeneration++;
+		return;
+	}
+	
+	if(SchedulerDue && SchedulerDue <= due)
+		return;
+	
+	SchedulerDue = due;
+	SchedulerGeneration++;
+	glutTimerFunc(FRAME_INTERVAL, schedulerTimer, SchedulerGeneration);
+}
+
+void schedulerTimer(int value)
+{
+	if(value != SchedulerGeneration)
+		return;
+	
+	SchedulerDue = 0.0;
+	
+	// the 3D game's piece falls a layer every Speed ms, catching up on any
+	// the timer was late for
+	
+	double now = getTime();
+	
+	for (; Well && !Well->game_over && now >= WellFallDue; WellFallDue += Speed)
+		blocksWellMovePiece(Well, WELL_DOWN);
+	
+	// the camera and falling piece move between snapshots, so the game window
+	// is redrawn every time
+	
+	refreshDirty();
+	glutPostWindowRedisplay(GameWindow);
+	schedule();
+}
+
+void saveReplay()
+{
+	const char *path = getenv("BLOCKS3D_REPLAY");
+	
+	if(!path || !Loop || !Loop->recorder || !Loop->recorder->num_calls)
+		return;
+	
+	if(!blocksSaveReplay(Loop->recorder, Game, path))
+		fprintf(stderr, "BLOCKS3D: Error writing the replay to %s.\n", path);
+}
+
+void gameTick(BlocksLoop *loop, void *data)
+{
+	int i;
+	Input input;
 	
-	glutTimerFunc(RotationSpeed, rotationTimer, 0);
+	for (i = 0; atomic_load(&Autoplay) && !Game->game_over && i < AutoplaySpeed; i++)
+	{
+		BLOCKS_PROFILE_BEGIN(PROFILE_AI);
+		
+		if(blocksAINextInput(AI, Game, &input))
+			blocksLoopApplyInput(loop, input);
+		
+		BLOCKS_PROFILE_END(PROFILE_AI);
+	}
 }
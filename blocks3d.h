@@ -6,6 +6,9 @@
  * @author Timothy Cheeseman
  */
 
+#ifndef _BLOCKS3D_H
+#define _BLOCKS3D_H
+
 #include <stdbool.h>
 
 /**
@@ -25,11 +28,21 @@ typedef enum Difficulty {
  */
 void initGL();
 
+/**
+ * Get a GL entry point from GLUT, NULL where GLUT can't load them
+ */
+void *getProcAddress(const char *name);
+
 /**
  * Display function for the main window
  */
 void mainWindowDisplay();
 
+/**
+ * Compile the main window's border, title, instructions and labels into a display list
+ */
+void compileHud();
+
 /**
  * Reshape function for the main window
  */
@@ -40,11 +53,49 @@ void mainWindowReshape(int width, int height);
  */
 void mainWindowKeyboard(unsigned char key, int x, int y);
 
+/**
+ * Keyboard release handler for all windows, ending held piece controls
+ */
+void mainWindowKeyboardUp(unsigned char key, int x, int y);
+
+/**
+ * Get the piece control input of a key, returning false if it isn't one
+ */
+bool keyInput(unsigned char key, Input *input);
+
+/**
+ * Get the piece control input of a key in the 3D game, returning false if it isn't one
+ */
+bool wellKeyInput(unsigned char key, WellInput *input);
+
 /**
  * Display function for the game sub-window
  */
 void gameWindowDisplay();
 
+/**
+ * Draw text at the raster position for the views
+ */
+void drawText(const char *text);
+
+/**
+ * Draw the average game window frame time over the last frames, and the
+ * statistics of every timer when profiling
+ */
+void drawFrameTime();
+
+#ifdef BLOCKS_PROFILE
+/**
+ * Write the timings to BLOCKS3D_PROFILE, or blocks3d-profile.csv, on exit
+ */
+void dumpProfile();
+#endif
+
+/**
+ * Get the current value of the monotonic clock in ms
+ */
+double getTime();
+
 /**
  * Reshape function for the game sub-window
  */
@@ -61,76 +112,77 @@ void nextPieceWindowDisplay();
 void nextPieceWindowReshape(int width, int height);
 
 /**
- * Post a GLUT redisplay for all windows and sub-windows
+ * Read the latest snapshot and post a GLUT redisplay for all windows and sub-windows
  */
 void refresh();
 
 /**
- * Initialize the game state based on a given difficulty
+ * Read the latest snapshot and post a GLUT redisplay for only the windows
+ * showing parts of the game that have changed since the last one
  */
-void initGame(Difficulty difficulty);
+void refreshDirty();
 
 /**
- * Function to start the game and rotation timers
+ * Initialize the game state based on a given difficulty
  */
-void startGame();
+void initGame(Difficulty difficulty);
 
 /**
- * The GLUT time for triggering a piece fall
+ * Function to start the game, ticking the loop from now on the simulation thread
  */
-void gameTimer(int value);
+void startGame();
 
 /**
- * The GLUT timer for rotating the camera
+ * Initialize a 3D game in place of the game, played on the GLUT thread
  */
-void rotationTimer(int value);
+void initWell();
 
 /**
- * The title of the game
+ * Function to start the 3D game, or carry it on after a pause
  */
-const char *Title = "Blocks 3D";
+void startWell();
 
 /**
- * The main window handle
+ * Check if the game or 3D game being played is over
  */
-int MainWindow;
+bool gameOver();
 
 /**
- * The game sub-window handle
+ * Start the simulation thread
  */
-int GameWindow;
+void startSimulation();
 
 /**
- * The next piece sub-window handle
+ * Stop the simulation thread and wait for it to finish its tick, if it is running
  */
-int NextPieceWindow;
+void stopSimulation();
 
 /**
- * The game data structure
+ * The simulation thread, running the loop's ticks as they fall due and
+ * publishing a snapshot of the game after them
  */
-BlocksGame *Game;
+void *simulationThread(void *data);
 
 /**
- * Whether or not the game is paused
+ * Arm the scheduler's timer to check for a new snapshot, unless it is already
+ * armed, so there is only ever one timer running
  */
-bool Paused;
+void schedule();
 
 /**
- * The speed of the game (time in ms for a piece to drop one level)
+ * The GLUT timer reading the latest snapshot and redisplaying what changed
  */
-int Speed;
+void schedulerTimer(int value);
 
 /**
- * The current camera X and Y rotation values
+ * Write the recording of the current game to BLOCKS3D_REPLAY, if anything has
+ * been played, with the simulation stopped
  */
-GLdouble Rotation[2];
+void saveReplay();
 
 /**
- * The camera X and Y rotation deltas
+ * Loop tick callback making the computer player's inputs, on the simulation thread
  */
-GLdouble RotationDelta[2];
+void gameTick(BlocksLoop *loop, void *data);
 
-/**
- * The camera rotation speed
- */
-int RotationSpeed;
+#endif /* _BLOCKS3D_H */
@@ -0,0 +1,432 @@
+/**
+ * blocksai.c
+ *
+ * Computer player for the Blocks library
+ *
+ * @author Timothy Cheeseman
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "blocksai.h"
+
+const AIWeights BlocksAIDefaultWeights = {
+	.aggregate_height = -0.510066,
+	.lines = 0.760666,
+	.holes = -0.35663,
+	.bumpiness = -0.184483
+};
+
+/**
+ * Print an error to stderr and exit with EXIT_FAILURE
+ */
+static void aiError(const char *message);
+
+/**
+ * Score a game, lines being the number of lines cleared since the search started
+ */
+static double aiEvaluate(const BlocksAI *ai, const BlocksGame *game, long lines);
+
+/**
+ * Choose a placement and record the inputs and states along its path
+ */
+static bool aiPlan(BlocksAI *ai, const BlocksGame *game);
+
+/**
+ * Search the next piece on every board of the beam across all workers
+ */
+static void aiSearchBeam(BlocksAI *ai);
+
+/**
+ * Take boards of the beam until there are none left and find the best score
+ * reachable by placing the next piece on each of them
+ */
+static void aiExpandBeam(AIWorker *worker);
+
+/**
+ * Worker thread entry point, expands the beam each time a search starts
+ */
+static void *aiWorker(void *data);
+
+static void aiError(const char *message)
+{
+	fprintf(stderr, "BLOCKS3D: %s\n", message);
+	exit(EXIT_FAILURE);
+}
+
+BlocksAI *blocksNewAI(int width, int height, int beam_width, int num_threads)
+{
+	int i;
+	BlocksAI *ai = malloc(sizeof(BlocksAI));
+
+	if(!ai)
+		aiError("Error allocating memory for a computer player.");
+
+	if(beam_width <= 0)
+		aiError("The beam width of a computer player must be positive.");
+
+	if(num_threads <= 0)
+		num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+	// more threads than boards in the beam would have nothing to do
+
+	if(num_threads > beam_width)
+		num_threads = beam_width;
+
+	if(num_threads <= 0)
+		num_threads = 1;
+
+	ai->width = width;
+	ai->height = height + BLOCKS_BUFFER_HEIGHT;
+	ai->beam_width = beam_width;
+	ai->weights = BlocksAIDefaultWeights;
+
+	ai->generator = blocksNewMoveGenerator(width, height);
+	ai->scores = malloc(ai->generator->num_states * sizeof(double));
+	ai->num_beam = 0;
+	ai->beam = malloc(beam_width * sizeof(int));
+	ai->best = malloc(beam_width * sizeof(double));
+
+	// a path never visits a state twice, so it is shorter than the number of states
+
+	ai->plan.piece = -1;
+	ai->plan.length = 0;
+	ai->plan.step = 0;
+	ai->plan.inputs = malloc((ai->generator->num_states + 1) * sizeof(Input));
+	ai->plan.states = malloc((ai->generator->num_states + 1) * sizeof(*ai->plan.states));
+
+	if(!ai->scores || !ai->beam || !ai->best || !ai->plan.inputs || !ai->plan.states)
+		aiError("Error allocating memory for a computer player.");
+
+	// each worker gets two games, rounded up to whole cache lines
+
+	size_t stride = (blocksGameSize(width, height) + 63) & ~(size_t) 63;
+
+	ai->num_workers = num_threads;
+	ai->workers = aligned_alloc(_Alignof(AIWorker), num_threads * sizeof(AIWorker));
+
+	if(!ai->workers)
+		aiError("Error allocating memory for a computer player.");
+
+	pthread_mutex_init(&ai->lock, NULL);
+	pthread_cond_init(&ai->start, NULL);
+	pthread_cond_init(&ai->done, NULL);
+	ai->generation = 0;
+	ai->pending = 0;
+	ai->quit = false;
+	ai->root = NULL;
+	atomic_init(&ai->next_entry, 0);
+
+	for(i = 0; i < num_threads; i++)
+	{
+		AIWorker *worker = &ai->workers[i];
+		char *storage = aligned_alloc(64, 2 * stride);
+
+		if(!storage)
+			aiError("Error allocating memory for a computer player.");
+
+		worker->ai = ai;
+		worker->generator = blocksNewMoveGenerator(width, height);
+		worker->candidate = storage;
+		worker->scratch = storage + stride;
+	}
+
+	// the first worker is the thread calling the search
+
+	for(i = 1; i < num_threads; i++)
+	{
+		if(pthread_create(&ai->workers[i].thread, NULL, aiWorker, &ai->workers[i]))
+			aiError("Error creating a computer player thread.");
+	}
+
+	return ai;
+}
+
+const Placement *blocksAIChoosePlacement(BlocksAI *ai, const BlocksGame *game)
+{
+	int i, j;
+
+	if(game->game_over)
+		return NULL;
+
+	if(game->width != ai->width || game->height != ai->height)
+		aiError("Searching a game of a different size.");
+
+	int num_placements = blocksGenerateMoves(ai->generator, game);
+	const Placement *placements = ai->generator->placements;
+
+	if(!num_placements)
+		return NULL;
+
+	// score every placement of the current piece on its own, keeping the best
+	// beam_width in order with ties going to the first found
+
+	ai->num_beam = 0;
+
+	for(i = 0; i < num_placements; i++)
+	{
+		BlocksGame *scratch = blocksCloneGame(game, ai->workers[0].scratch);
+
+		blocksApplyPlacement(scratch, &placements[i]);
+		ai->scores[i] = aiEvaluate(ai, scratch, scratch->lines_cleared - game->lines_cleared);
+
+		if(ai->num_beam == ai->beam_width && ai->scores[i] <= ai->scores[ai->beam[ai->num_beam - 1]])
+			continue;
+
+		if(ai->num_beam < ai->beam_width)
+			ai->num_beam++;
+
+		for(j = ai->num_beam - 1; j > 0 && ai->scores[i] > ai->scores[ai->beam[j - 1]]; j--)
+			ai->beam[j] = ai->beam[j - 1];
+
+		ai->beam[j] = i;
+	}
+
+	// then choose the board of the beam with the best placement of the next piece
+
+	ai->root = game;
+	aiSearchBeam(ai);
+
+	int best = 0;
+
+	for(i = 1; i < ai->num_beam; i++)
+		if(ai->best[i] > ai->best[best])
+			best = i;
+
+	return &placements[ai->beam[best]];
+}
+
+int blocksAIPlacePiece(BlocksAI *ai, BlocksGame *game)
+{
+	const Placement *placement = blocksAIChoosePlacement(ai, game);
+
+	if(!placement)
+		return 0;
+
+	blocksApplyPlacement(game, placement);
+
+	return placement->path_length + 1;
+}
+
+bool blocksAINextInput(BlocksAI *ai, const BlocksGame *game, Input *input)
+{
+	AIPlan *plan = &ai->plan;
+	const Tetromino *piece = game->current_piece;
+
+	if(game->game_over)
+		return false;
+
+	// follow the plan as long as the piece is where the plan expects it
+
+	if(plan->piece != game->pieces_placed || plan->step >= plan->length ||
+	   plan->states[plan->step][0] != piece->position[0] ||
+	   plan->states[plan->step][1] != piece->position[1] ||
+	   plan->states[plan->step][2] != piece->rotation)
+	{
+		if(!aiPlan(ai, game))
+			return false;
+	}
+
+	*input = plan->inputs[plan->step++];
+
+	return true;
+}
+
+static bool aiPlan(BlocksAI *ai, const BlocksGame *game)
+{
+	int i;
+	AIPlan *plan = &ai->plan;
+	const Placement *placement = blocksAIChoosePlacement(ai, game);
+
+	if(!placement)
+		return false;
+
+	plan->piece = game->pieces_placed;
+	plan->step = 0;
+	plan->length = blocksPlacementPath(ai->generator, placement, plan->inputs);
+
+	// play the path on a copy of the game to know where the piece should be
+	// before each input
+
+	BlocksGame *copy = blocksCloneGame(game, ai->workers[0].scratch);
+
+	for(i = 0; i < plan->length; i++)
+	{
+		plan->states[i][0] = copy->current_piece->position[0];
+		plan->states[i][1] = copy->current_piece->position[1];
+		plan->states[i][2] = copy->current_piece->rotation;
+
+		blocksApplyInput(copy, plan->inputs[i]);
+	}
+
+	return true;
+}
+
+static double aiEvaluate(const BlocksAI *ai, const BlocksGame *game, long lines)
+{
+	int x, y;
+	int aggregate_height = 0;
+	int bumpiness = 0;
+	int holes = 0;
+	int highest = game->height;
+
+	if(game->game_over)
+		return -HUGE_VAL;
+
+	for(x = 0; x < game->width; x++)
+	{
+		int column_height = game->height - game->skyline[x];
+
+		aggregate_height += column_height;
+
+		if(x)
+			bumpiness += abs(column_height - (game->height - game->skyline[x - 1]));
+
+		if(game->skyline[x] < highest)
+			highest = game->skyline[x];
+	}
+
+	// a hole is an empty cell with an occupied cell anywhere above it, found a
+	// row at a time by carrying the occupied columns down
+
+	BlocksRow covered = 0;
+
+	for(y = highest; y < game->height; y++)
+	{
+		holes += __builtin_popcountll(covered & ~game->rows[y]);
+		covered |= game->rows[y];
+	}
+
+	return ai->weights.aggregate_height * aggregate_height +
+	       ai->weights.lines * lines +
+	       ai->weights.holes * holes +
+	       ai->weights.bumpiness * bumpiness;
+}
+
+static void aiSearchBeam(BlocksAI *ai)
+{
+	atomic_store(&ai->next_entry, 0);
+
+	if(ai->num_workers == 1 || ai->num_beam == 1)
+	{
+		aiExpandBeam(&ai->workers[0]);
+		return;
+	}
+
+	pthread_mutex_lock(&ai->lock);
+	ai->pending = ai->num_workers - 1;
+	ai->generation++;
+	pthread_cond_broadcast(&ai->start);
+	pthread_mutex_unlock(&ai->lock);
+
+	aiExpandBeam(&ai->workers[0]);
+
+	pthread_mutex_lock(&ai->lock);
+
+	while(ai->pending)
+		pthread_cond_wait(&ai->done, &ai->lock);
+
+	pthread_mutex_unlock(&ai->lock);
+}
+
+static void aiExpandBeam(AIWorker *worker)
+{
+	int entry, i;
+	BlocksAI *ai = worker->ai;
+	const BlocksGame *root = ai->root;
+
+	while((entry = atomic_fetch_add(&ai->next_entry, 1)) < ai->num_beam)
+	{
+		BlocksGame *candidate = blocksCloneGame(root, worker->candidate);
+
+		blocksApplyPlacement(candidate, &ai->generator->placements[ai->beam[entry]]);
+
+		// a board that ends the game keeps its score, there is nothing to search
+
+		int num_placements = blocksGenerateMoves(worker->generator, candidate);
+		double best = num_placements ? -HUGE_VAL : ai->scores[ai->beam[entry]];
+
+		for(i = 0; i < num_placements; i++)
+		{
+			BlocksGame *scratch = blocksCloneGame(candidate, worker->scratch);
+
+			blocksApplyPlacement(scratch, &worker->generator->placements[i]);
+
+			double score = aiEvaluate(ai, scratch, scratch->lines_cleared - root->lines_cleared);
+
+			if(score > best)
+				best = score;
+		}
+
+		ai->best[entry] = best;
+	}
+}
+
+static void *aiWorker(void *data)
+{
+	AIWorker *worker = data;
+	BlocksAI *ai = worker->ai;
+	int generation = 0;
+
+	pthread_mutex_lock(&ai->lock);
+
+	for(;;)
+	{
+		while(ai->generation == generation && !ai->quit)
+			pthread_cond_wait(&ai->start, &ai->lock);
+
+		if(ai->quit)
+			break;
+
+		generation = ai->generation;
+		pthread_mutex_unlock(&ai->lock);
+
+		aiExpandBeam(worker);
+
+		pthread_mutex_lock(&ai->lock);
+
+		if(!--ai->pending)
+			pthread_cond_signal(&ai->done);
+	}
+
+	pthread_mutex_unlock(&ai->lock);
+
+	return NULL;
+}
+
+void blocksFreeAI(BlocksAI *ai)
+{
+	int i;
+
+	pthread_mutex_lock(&ai->lock);
+	ai->quit = true;
+	pthread_cond_broadcast(&ai->start);
+	pthread_mutex_unlock(&ai->lock);
+
+	for(i = 1; i < ai->num_workers; i++)
+		pthread_join(ai->workers[i].thread, NULL);
+
+	for(i = 0; i < ai->num_workers; i++)
+	{
+		blocksFreeMoveGenerator(ai->workers[i].generator);
+		free(ai->workers[i].candidate);
+	}
+
+	pthread_mutex_destroy(&ai->lock);
+	pthread_cond_destroy(&ai->start);
+	pthread_cond_destroy(&ai->done);
+
+	blocksFreeMoveGenerator(ai->generator);
+	free(ai->scores);
+	free(ai->beam);
+	free(ai->best);
+	free(ai->plan.inputs);
+	free(ai->plan.states);
+	free(ai->workers);
+
+	free(ai);
+}
@@ -0,0 +1,133 @@
+/**
+ * blocksai.h
+ *
+ * Computer player for the Blocks library
+ *
+ * @author Timothy Cheeseman
+ */
+
+#ifndef _BLOCKSAI_H
+#define _BLOCKSAI_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "blocks.h"
+#include "blocksmoves.h"
+
+/**
+ * The weights of the board features a computer player scores boards with,
+ * positive weights being rewarded and negative ones penalized
+ */
+typedef struct AIWeights {
+
+	double aggregate_height;
+	double lines;
+	double holes;
+	double bumpiness;
+
+} AIWeights;
+
+/**
+ * The default weights, tuned for a 10 wide board
+ */
+extern const AIWeights BlocksAIDefaultWeights;
+
+/**
+ * The inputs planned to move the current piece to the chosen placement, with
+ * the position and rotation the piece is expected to be in before each input
+ */
+typedef struct AIPlan {
+
+	long piece;
+	int length;
+	int step;
+	Input *inputs;
+	int (*states)[3];
+
+} AIPlan;
+
+/**
+ * A computer player thread with its own move generator and games to place
+ * pieces in, kept on separate cache lines
+ */
+typedef struct AIWorker {
+
+	_Alignas(64) struct BlocksAI *ai;
+	pthread_t thread;
+	MoveGenerator *generator;
+	void *candidate;
+	void *scratch;
+
+} AIWorker;
+
+/**
+ * Computer player that searches every placement of the current piece, keeps
+ * the best beam_width boards and searches every placement of the next piece on
+ * each of them
+ */
+typedef struct BlocksAI {
+
+	int width;
+	int height;
+	int beam_width;
+	AIWeights weights;
+
+	MoveGenerator *generator;
+	double *scores;
+	int num_beam;
+	int *beam;
+	double *best;
+
+	AIPlan plan;
+
+	int num_workers;
+	AIWorker *workers;
+	pthread_mutex_t lock;
+	pthread_cond_t start;
+	pthread_cond_t done;
+	int generation;
+	int pending;
+	bool quit;
+	const BlocksGame *root;
+	_Atomic int next_entry;
+
+} BlocksAI;
+
+/**
+ * Create a computer player for games of a given size. The search of the next
+ * piece is spread over num_threads threads (counting the caller), or over all
+ * cores if num_threads is 0.
+ */
+BlocksAI *blocksNewAI(int width, int height, int beam_width, int num_threads);
+
+/**
+ * Search a game for the best placement of its current piece
+ *
+ * Returns the placement, or NULL if the game is over.
+ */
+const Placement *blocksAIChoosePlacement(BlocksAI *ai, const BlocksGame *game);
+
+/**
+ * Choose and lock the current piece of a game in the best placement, without
+ * stepping through the inputs that lead to it
+ *
+ * Returns the number of inputs the placement takes, or 0 if the game is over.
+ */
+int blocksAIPlacePiece(BlocksAI *ai, BlocksGame *game);
+
+/**
+ * Get the next input towards the best placement of the current piece of a
+ * game, searching again whenever a new piece spawns or the piece was moved by
+ * anything other than the computer player (such as gravity)
+ *
+ * Returns false if the game is over.
+ */
+bool blocksAINextInput(BlocksAI *ai, const BlocksGame *game, Input *input);
+
+/**
+ * Free the memory and threads used by a computer player
+ */
+void blocksFreeAI(BlocksAI *ai);
+
+#endif /* _BLOCKSAI_H */
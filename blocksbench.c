@@ -0,0 +1,635 @@
+/**
+ * blocksbench.c
+ *
+ * Microbenchmarks of the Blocks engine's hot paths over a range of board
+ * sizes, reported as JSON
+ *
+ * @author Timothy Cheeseman
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+#include "blocks.h"
+
+/**
+ * The board sizes benchmarked, widths beyond BLOCKS_MAX_WIDTH being skipped
+ */
+static const int BenchWidths[] = {10, 16, 32, 64, 128, 256};
+static const int BenchHeights[] = {20, 64, 256, 1024};
+
+/**
+ * The number of random piece positions the collision benchmark cycles through
+ */
+#define BENCH_POSITIONS 1024
+
+/**
+ * A board being benchmarked: a game filled to half its height, with every
+ * column but one random so no row is full, and a state of it to restore
+ */
+typedef struct BenchBoard {
+
+	BlocksGame *game;
+	void *state;
+	uint64_t seed;
+	int hole;
+
+	int positions[BENCH_POSITIONS][2];
+
+} BenchBoard;
+
+/**
+ * A benchmark running iterations of an operation on a board. Operations that
+ * restore the board before each iteration are measured against a baseline
+ * that only restores it, and the baseline subtracted.
+ */
+typedef struct BenchOp {
+
+	const char *name;
+	void (*setup)(BenchBoard *board, int clears);
+	void (*run)(BenchBoard *board, long iterations);
+	void (*baseline)(BenchBoard *board, long iterations);
+	int clears;
+
+} BenchOp;
+
+/**
+ * The cost of some iterations of an operation
+ */
+typedef struct BenchCost {
+
+	double ns;
+	long allocations;
+	long long cache_misses;
+
+} BenchCost;
+
+/**
+ * Allocations made by the engine and the benchmarks, counted when the engine's
+ * allocation functions are wrapped at link time
+ */
+static long BenchAllocations;
+
+/**
+ * The hardware cache miss counter, or -1 if there isn't one
+ */
+static int BenchCacheMisses = -1;
+
+/**
+ * Where results are written to stop the compiler optimizing benchmarks away
+ */
+static volatile long BenchSink;
+
+/**
+ * Print usage information to stderr and exit with EXIT_FAILURE
+ */
+static void benchUsage(const char *program);
+
+/**
+ * Print an error to stderr and exit with EXIT_FAILURE
+ */
+static void benchError(const char *message);
+
+/**
+ * Get the current value of the monotonic clock in ns
+ */
+static double benchTime();
+
+/**
+ * Open the cache miss counter for this thread, if perf events are available
+ */
+static void benchOpenCounters();
+
+/**
+ * Read the cache miss counter, 0 if there isn't one
+ */
+static long long benchReadCacheMisses();
+
+/**
+ * Create a board of a given size filled from a seed
+ */
+static void benchNewBoard(BenchBoard *board, int width, int height, uint64_t seed);
+
+/**
+ * Fill the bottom half of a board, the bottom clears rows full but for its hole
+ */
+static void benchFill(BenchBoard *board, int clears);
+
+/**
+ * Make the board's rows and the skyline they give its state to restore
+ */
+static void benchSaveBoard(BenchBoard *board);
+
+/**
+ * Measure iterations of a function on a board
+ */
+static BenchCost benchMeasure(void (*run)(BenchBoard *board, long iterations), BenchBoard *board, long iterations);
+
+/**
+ * Run an operation for at least min_time ns, returning its cost per iteration
+ */
+static BenchCost benchRun(const BenchOp *op, BenchBoard *board, double min_time, long *iterations);
+
+/**
+ * Free a board
+ */
+static void benchFreeBoard(BenchBoard *board);
+
+/**
+ * Setups placing the current piece for the operations
+ */
+static void benchSetupFalling(BenchBoard *board, int clears);
+static void benchSetupSpawned(BenchBoard *board, int clears);
+static void benchSetupLock(BenchBoard *board, int clears);
+
+/**
+ * The operations
+ */
+static void benchCollision(BenchBoard *board, long iterations);
+static void benchRotate(BenchBoard *board, long iterations);
+static void benchMove(BenchBoard *board, long iterations);
+static void benchDrop(BenchBoard *board, long iterations);
+static void benchLock(BenchBoard *board, long iterations);
+static void benchRestore(BenchBoard *board, long iterations);
+static void benchNewFree(BenchBoard *board, long iterations);
+
+static const BenchOp BenchOps[] = {
+
+	{"collision", benchSetupFalling, benchCollision, NULL, 0},
+	{"rotate", benchSetupFalling, benchRotate, NULL, 0},
+	{"move", benchSetupFalling, benchMove, NULL, 0},
+	{"drop", benchSetupSpawned, benchDrop, benchRestore, 0},
+	{"lock_clear_0", benchSetupLock, benchLock, benchRestore, 0},
+	{"lock_clear_1", benchSetupLock, benchLock, benchRestore, 1},
+	{"lock_clear_2", benchSetupLock, benchLock, benchRestore, 2},
+	{"lock_clear_3", benchSetupLock, benchLock, benchRestore, 3},
+	{"lock_clear_4", benchSetupLock, benchLock, benchRestore, 4},
+	{"new_free", benchSetupSpawned, benchNewFree, NULL, 0}
+
+};
+
+#ifdef BENCH_COUNT_ALLOCATIONS
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *pointer, size_t size);
+void *__real_aligned_alloc(size_t alignment, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+	BenchAllocations++;
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+	BenchAllocations++;
+	return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *pointer, size_t size)
+{
+	BenchAllocations++;
+	return __real_realloc(pointer, size);
+}
+
+void *__wrap_aligned_alloc(size_t alignment, size_t size)
+{
+	BenchAllocations++;
+	return __real_aligned_alloc(alignment, size);
+}
+#endif
+
+int main(int argc, char *argv[])
+{
+	int i, j, k, option;
+
+	double min_time = 20.0;
+	uint64_t seed = 1;
+	const char *filter = NULL;
+	bool first = true;
+
+	while((option = getopt(argc, argv, "t:S:f:")) != -1)
+	{
+		switch(option)
+		{
+			case 't':
+				min_time = atof(optarg);
+				break;
+			case 'S':
+				seed = strtoull(optarg, NULL, 0);
+				break;
+			case 'f':
+				filter = optarg;
+				break;
+			default:
+				benchUsage(argv[0]);
+		}
+	}
+
+	if(min_time <= 0.0)
+		benchUsage(argv[0]);
+
+	benchOpenCounters();
+
+	printf("{\n");
+	printf("\t\"benchmark\": \"blocks-bench\",\n");
+	printf("\t\"seed\": %llu,\n", (unsigned long long) seed);
+	printf("\t\"min_time_ms\": %g,\n", min_time);
+	printf("\t\"max_width\": %d,\n", BLOCKS_MAX_WIDTH);
+	printf("\t\"row_kernels\": \"%s\",\n", blocksRowKernels()->name);
+
+#ifdef BENCH_COUNT_ALLOCATIONS
+	printf("\t\"allocations_counted\": true,\n");
+#else
+	printf("\t\"allocations_counted\": false,\n");
+#endif
+
+	printf("\t\"cache_misses_counted\": %s,\n", BenchCacheMisses >= 0 ? "true" : "false");
+	printf("\t\"results\": [");
+
+	for(i = 0; i < (int) (sizeof(BenchWidths) / sizeof(BenchWidths[0])); i++)
+	{
+		if(BenchWidths[i] > BLOCKS_MAX_WIDTH)
+			continue;
+
+		for(j = 0; j < (int) (sizeof(BenchHeights) / sizeof(BenchHeights[0])); j++)
+		{
+			BenchBoard board;
+
+			benchNewBoard(&board, BenchWidths[i], BenchHeights[j], seed);
+
+			for(k = 0; k < (int) (sizeof(BenchOps) / sizeof(BenchOps[0])); k++)
+			{
+				const BenchOp *op = &BenchOps[k];
+				long iterations;
+
+				if(filter && !strstr(op->name, filter))
+					continue;
+
+				op->setup(&board, op->clears);
+
+				BenchCost cost = benchRun(op, &board, min_time * 1e6, &iterations);
+
+				printf("%s\n\t\t{\"name\": \"%s\", \"width\": %d, \"height\": %d, \"iterations\": %ld, "
+				       "\"ns_per_op\": %.2f, \"allocs_per_op\": %.3f, \"cache_misses_per_op\": ",
+				       first ? "" : ",", op->name, BenchWidths[i], BenchHeights[j], iterations,
+				       cost.ns, (double) cost.allocations / iterations);
+
+				if(BenchCacheMisses >= 0)
+					printf("%.3f}", (double) cost.cache_misses / iterations);
+				else
+					printf("null}");
+
+				fflush(stdout);
+				first = false;
+			}
+
+			benchFreeBoard(&board);
+		}
+	}
+
+	printf("\n\t]\n}\n");
+
+	return EXIT_SUCCESS;
+}
+
+static void benchUsage(const char *program)
+{
+	fprintf(stderr, "Usage: %s [-t min time per benchmark in ms] [-S seed] [-f name filter]\n", program);
+	fprintf(stderr, "Benchmarks the engine on boards from 10x20 up to the widest supported, writing JSON to stdout.\n");
+	exit(EXIT_FAILURE);
+}
+
+static void benchError(const char *message)
+{
+	fprintf(stderr, "BLOCKS3D: %s\n", message);
+	exit(EXIT_FAILURE);
+}
+
+static double benchTime()
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+static void benchOpenCounters()
+{
+#ifdef __linux__
+	struct perf_event_attr attributes;
+
+	memset(&attributes, 0, sizeof(attributes));
+	attributes.type = PERF_TYPE_HARDWARE;
+	attributes.size = sizeof(attributes);
+	attributes.config = PERF_COUNT_HW_CACHE_MISSES;
+	attributes.exclude_kernel = 1;
+	attributes.exclude_hv = 1;
+
+	// counting just this thread on any cpu, left running for the whole run
+
+	BenchCacheMisses = syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0);
+#endif
+}
+
+static long long benchReadCacheMisses()
+{
+	long long count = 0;
+
+	if(BenchCacheMisses >= 0 && read(BenchCacheMisses, &count, sizeof(count)) != sizeof(count))
+		count = 0;
+
+	return count;
+}
+
+static void benchNewBoard(BenchBoard *board, int width, int height, uint64_t seed)
+{
+	int i;
+	BlocksRandom random;
+
+	board->game = blocksNewGameSeeded(width, height, seed, RANDOMIZER_UNIFORM);
+	board->state = malloc(blocksStateSize(board->game));
+	board->seed = seed;
+
+	if(!board->state)
+		benchError("Error allocating memory for a benchmark board.");
+
+	// the positions the collision benchmark checks the current piece at, all
+	// within the board so every one is checked against the rows
+
+	blocksSeedRandom(&random, seed);
+	board->hole = blocksRandomBelow(&random, width);
+
+	for(i = 0; i < BENCH_POSITIONS; i++)
+	{
+		board->positions[i][0] = blocksRandomBelow(&random, width - BLOCKS_PIECE_SIZE + 1);
+		board->positions[i][1] = blocksRandomBelow(&random, board->game->height - BLOCKS_PIECE_SIZE + 1);
+	}
+}
+
+static void benchSaveBoard(BenchBoard *board)
+{
+	int x, y;
+	BlocksGame *game = board->game;
+
+	for(x = 0; x < game->width; x++)
+	{
+		game->skyline[x] = game->height;
+
+		for(y = game->height - 1; y >= 0; y--)
+			if(blocksCell(game, x, y))
+				game->skyline[x] = y;
+	}
+
+	blocksSaveState(game, board->state);
+}
+
+static void benchFill(BenchBoard *board, int clears)
+{
+	int i, w;
+	BlocksRandom random;
+	BlocksGame *game = board->game;
+	int words = game->row_words;
+	int filled = (game->height - BLOCKS_BUFFER_HEIGHT) / 2;
+
+	// the bottom clears rows are full but for the hole, the others are random
+	// with at least one more empty cell so placing a piece in the hole doesn't
+	// fill them
+
+	blocksSeedRandom(&random, board->seed);
+
+	for(i = 0; i < game->height; i++)
+	{
+		BlocksRow *row = game->rows + (size_t) (game->height - 1 - i) * words;
+		int empty = board->hole;
+
+		for(w = 0; w < words; w++)
+		{
+			BlocksRow columns = w < words - 1 ? ~(BlocksRow) 0 : game->full_row;
+
+			if(i >= filled)
+				row[w] = 0;
+			else if(i < clears)
+				row[w] = columns;
+			else
+				row[w] = blocksRandomNext(&random) & columns;
+		}
+
+		if(i >= clears && i < filled)
+		{
+			empty = blocksRandomBelow(&random, game->width - 1);
+			empty += empty >= board->hole;
+		}
+
+		row[board->hole / BLOCKS_ROW_BITS] &= ~((BlocksRow) 1 << board->hole % BLOCKS_ROW_BITS);
+		row[empty / BLOCKS_ROW_BITS] &= ~((BlocksRow) 1 << empty % BLOCKS_ROW_BITS);
+	}
+}
+
+static void benchSetupFalling(BenchBoard *board, int clears)
+{
+	BlocksGame *game = board->game;
+	Tetromino *piece = game->current_piece;
+
+	benchFill(board, clears);
+
+	// a T in the empty top half of the board, where it can move and rotate
+
+	piece->type = TETROMINO_T;
+	piece->rotation = 0;
+	piece->shape = &TetrominoShapes[TETROMINO_T][0];
+	piece->position[0] = game->width / 2 - 2;
+	piece->position[1] = BLOCKS_BUFFER_HEIGHT;
+	game->game_over = false;
+
+	benchSaveBoard(board);
+}
+
+static void benchSetupSpawned(BenchBoard *board, int clears)
+{
+	BlocksGame *game = board->game;
+	Tetromino *piece = game->current_piece;
+
+	benchFill(board, clears);
+
+	piece->type = TETROMINO_T;
+	piece->rotation = 0;
+	piece->shape = &TetrominoShapes[TETROMINO_T][0];
+	piece->position[0] = game->width / 2 - 2;
+	piece->position[1] = BLOCKS_BUFFER_HEIGHT - piece->shape->height;
+	game->game_over = false;
+
+	benchSaveBoard(board);
+}
+
+static void benchSetupLock(BenchBoard *board, int clears)
+{
+	BlocksGame *game = board->game;
+	Tetromino *piece = game->current_piece;
+
+	benchFill(board, clears);
+
+	// an upright I resting on the bottom of the hole, which runs all the way
+	// down, so moving it down locks it and clears the full rows
+
+	piece->type = TETROMINO_I;
+	piece->rotation = 0;
+	piece->shape = &TetrominoShapes[TETROMINO_I][0];
+	piece->position[0] = board->hole;
+	piece->position[1] = game->height - piece->shape->height;
+	game->game_over = false;
+
+	benchSaveBoard(board);
+}
+
+static BenchCost benchMeasure(void (*run)(BenchBoard *board, long iterations), BenchBoard *board, long iterations)
+{
+	BenchCost cost;
+
+	long allocations = BenchAllocations;
+	long long cache_misses = benchReadCacheMisses();
+	double start = benchTime();
+
+	run(board, iterations);
+
+	cost.ns = benchTime() - start;
+	cost.cache_misses = benchReadCacheMisses() - cache_misses;
+	cost.allocations = BenchAllocations - allocations;
+
+	return cost;
+}
+
+static BenchCost benchRun(const BenchOp *op, BenchBoard *board, double min_time, long *iterations)
+{
+	BenchCost cost;
+	long n = 16;
+
+	// warm up, then double the iterations until they take long enough
+
+	benchMeasure(op->run, board, n);
+
+	for(;; n *= 2)
+	{
+		cost = benchMeasure(op->run, board, n);
+
+		if(cost.ns >= min_time)
+			break;
+	}
+
+	if(op->baseline)
+	{
+		BenchCost baseline = benchMeasure(op->baseline, board, n);
+
+		cost.ns -= baseline.ns;
+		cost.allocations -= baseline.allocations;
+		cost.cache_misses -= baseline.cache_misses;
+
+		if(cost.ns < 0.0)
+			cost.ns = 0.0;
+	}
+
+	cost.ns /= n;
+	*iterations = n;
+
+	return cost;
+}
+
+static void benchFreeBoard(BenchBoard *board)
+{
+	blocksFreeGame(board->game);
+	free(board->state);
+}
+
+static void benchCollision(BenchBoard *board, long iterations)
+{
+	long i;
+	long collisions = 0;
+	const BlocksGame *game = board->game;
+	const TetrominoShape *shape = game->current_piece->shape;
+
+	for(i = 0; i < iterations; i++)
+	{
+		const int *position = board->positions[i % BENCH_POSITIONS];
+
+		collisions += blocksShapeCollision(game, shape, position[0], position[1]);
+	}
+
+	BenchSink = collisions;
+}
+
+static void benchRotate(BenchBoard *board, long iterations)
+{
+	long i;
+
+	for(i = 0; i < iterations; i++)
+		blocksRotatePiece(board->game);
+
+	BenchSink = board->game->current_piece->rotation;
+}
+
+static void benchMove(BenchBoard *board, long iterations)
+{
+	long i;
+
+	// back and forth, so the piece never reaches a wall
+
+	for(i = 0; i < iterations; i++)
+		blocksMovePiece(board->game, i & 1 ? DIRECTION_RIGHT : DIRECTION_LEFT);
+
+	BenchSink = board->game->current_piece->position[0];
+}
+
+static void benchDrop(BenchBoard *board, long iterations)
+{
+	long i;
+
+	for(i = 0; i < iterations; i++)
+	{
+		blocksRestoreState(board->game, board->state);
+		blocksDropPiece(board->game);
+	}
+
+	BenchSink = board->game->score;
+}
+
+static void benchLock(BenchBoard *board, long iterations)
+{
+	long i;
+
+	for(i = 0; i < iterations; i++)
+	{
+		blocksRestoreState(board->game, board->state);
+		blocksMovePiece(board->game, DIRECTION_DOWN);
+	}
+
+	BenchSink = board->game->lines_cleared;
+}
+
+static void benchRestore(BenchBoard *board, long iterations)
+{
+	long i;
+
+	for(i = 0; i < iterations; i++)
+		blocksRestoreState(board->game, board->state);
+
+	BenchSink = board->game->score;
+}
+
+static void benchNewFree(BenchBoard *board, long iterations)
+{
+	long i;
+	int width = board->game->width;
+	int height = board->game->height - BLOCKS_BUFFER_HEIGHT;
+
+	for(i = 0; i < iterations; i++)
+		blocksFreeGame(blocksNewGameSeeded(width, height, i, RANDOMIZER_UNIFORM));
+}
@@ -0,0 +1,618 @@
+/**
+ * blocksdraw.c
+ *
+ * OpenGL drawing of Blocks games, shared by the GLUT and offscreen frontends
+ *
+ * @author Timothy Cheeseman
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef __APPLE__
+#include <OpenGL/glu.h>
+#else
+#include <GL/glu.h>
+#endif
+
+#include "blocksdraw.h"
+
+/**
+ * Print an error to stderr and exit with EXIT_FAILURE
+ */
+static void drawError(const char *message);
+
+/**
+ * Draw the locked blocks and the current piece with a single instanced draw,
+ * the piece fall rows below its row
+ */
+static void drawInstances(BlocksView *view, const BlocksGame *game, double fall);
+
+/**
+ * Compile the mesh of the locked blocks of a game into the view's board display list
+ */
+static void drawCompileBoard(BlocksView *view, const BlocksGame *game);
+
+/**
+ * Get the center of a cell of a well in the coordinates a well is drawn in
+ */
+static void drawWellPosition(const BlocksWell *well, int x, int y, int z, GLfloat position[3]);
+
+/**
+ * Draw a cube in a cell of a well, adding it to the view's instances if it has
+ * a renderer, or else as a solid cube with black edges
+ */
+static void drawWellCube(BlocksView *view, const BlocksWell *well, int x, int y, int z, Color color);
+
+/**
+ * Draw a solid cube of a given size around the origin
+ */
+static void drawSolidCube(GLdouble size);
+
+/**
+ * Draw the edges of a cube of a given size around the origin
+ */
+static void drawWireCube(GLdouble size);
+
+static void drawError(const char *message)
+{
+	fprintf(stderr, "BLOCKS3D: %s\n", message);
+	exit(EXIT_FAILURE);
+}
+
+BlocksView *blocksNewView(InstanceRenderer *instances)
+{
+	BlocksView *view = malloc(sizeof(BlocksView));
+
+	if(!view)
+		drawError("Error allocating memory for a view.");
+
+	view->instances = instances;
+	view->board_instances = 0;
+
+	view->mesh = NULL;
+	view->board_list = 0;
+	view->board_pieces = -1;
+
+	view->rotation_delta[0] = 0.0;
+	view->rotation_delta[1] = 0.0;
+	view->rotation_speed = 50;
+
+	view->draw_text = NULL;
+
+	return view;
+}
+
+void blocksResetView(BlocksView *view)
+{
+	view->board_pieces = -1;
+}
+
+void blocksGameProjection()
+{
+	glMatrixMode(GL_PROJECTION);
+	glLoadIdentity();
+	glOrtho(-125.0, 125.0, -125.0, 125.0, -200.0, 200.0);
+
+	glMatrixMode(GL_MODELVIEW);
+}
+
+void blocksNextPieceProjection()
+{
+	glMatrixMode(GL_PROJECTION);
+	glLoadIdentity();
+	glOrtho(-2.5, 2.5, -2.5, 2.5, -100.0, 100.0);
+
+	glMatrixMode(GL_MODELVIEW);
+}
+
+void blocksDrawGame(BlocksView *view, const BlocksSnapshot *snapshot, double now)
+{
+	int i, j;
+	int landing_row;
+	const BlocksGame *game = snapshot->game;
+
+	// the camera and the falling piece are drawn part way to where the next
+	// tick moves them, and the camera keeps turning after the game is over and
+	// the simulation has stopped
+
+	double elapsed = now - snapshot->tick_start;
+
+	if(elapsed < 0.0)
+		elapsed = 0.0;
+
+	if(elapsed > snapshot->tick_length && !game->game_over)
+		elapsed = snapshot->tick_length;
+
+	double fall = blocksSnapshotFallOffset(snapshot, elapsed / snapshot->tick_length);
+	double turn = (snapshot->tick * snapshot->tick_length + elapsed) / view->rotation_speed;
+
+	glLoadIdentity();
+	gluLookAt(-2.0, 2.0, 10.0, 0.0, 0.0, 0.0, 0.0, 1.0, 0.0);
+	glRotated(view->rotation_delta[0] * turn, 1.0, 0.0, 0.0);
+	glRotated(view->rotation_delta[1] * turn, 0.0, 1.0, 0.0);
+
+	// draw boundaries
+
+	glColor3ub(0, 0, 255);
+
+	glPushMatrix();
+	glTranslatef(0.0, 5.0, 0.0);
+	glScalef(game->width, game->height - BLOCKS_BUFFER_HEIGHT, 1.0);
+
+	drawWireCube(10.0);
+	glPopMatrix();
+
+	if(view->instances)
+		drawInstances(view, game, fall);
+	else
+	{
+		// draw blocks, recompiling them only after a piece has been locked
+
+		if(view->board_pieces != game->pieces_placed)
+			drawCompileBoard(view, game);
+
+		glCallList(view->board_list);
+
+		// draw piece
+
+		for (i = 0; i < game->current_piece->shape->height; i++)
+		{
+			int y = game->current_piece->position[1] + i;
+
+			for (j = 0; j < game->current_piece->shape->width; j++)
+			{
+				int x = game->current_piece->position[0] + j;
+
+				glPushMatrix();
+				glTranslatef(-45.0 + 10.0 * x, game->height * 10.0 - 100.0 - 10.0 * (y + fall), 0.0);
+
+				if(blocksPieceCell(game->current_piece, j, i) && y >= BLOCKS_BUFFER_HEIGHT)
+				{
+					glColor3ub(game->current_piece->color.r, game->current_piece->color.g, game->current_piece->color.b);
+					drawSolidCube(10.0);
+
+					glColor3ub(0, 0, 0);
+					drawWireCube(10.0);
+				}
+
+				glPopMatrix();
+			}
+		}
+	}
+
+	// draw ghost piece where the piece would land
+
+	landing_row = blocksLandingRow(game);
+
+	for (i = 0; i < game->current_piece->shape->height && !game->game_over; i++)
+	{
+		int y = landing_row + i;
+
+		if(landing_row == game->current_piece->position[1])
+			break;
+
+		for (j = 0; j < game->current_piece->shape->width; j++)
+		{
+			int x = game->current_piece->position[0] + j;
+
+			if(blocksPieceCell(game->current_piece, j, i) && y >= BLOCKS_BUFFER_HEIGHT)
+			{
+				glPushMatrix();
+				glTranslatef(-45.0 + 10.0 * x, game->height * 10.0 - 100.0 - 10.0 * y, 0.0);
+
+				glColor3ub(game->current_piece->color.r, game->current_piece->color.g, game->current_piece->color.b);
+				drawWireCube(10.0);
+
+				glPopMatrix();
+			}
+		}
+	}
+
+	if(game->game_over && view->draw_text)
+	{
+		glLoadIdentity();
+		glColor3ub(255, 0, 0);
+		glRasterPos3d(-30.0, 0.0, 200.0);
+
+		view->draw_text("Game Over!");
+	}
+}
+
+void blocksDrawNextPiece(BlocksView *view, const BlocksGame *game)
+{
+	int i, j;
+	const Tetromino *piece = game->next_piece;
+
+	if(game->game_over)
+		return;
+
+	glLoadIdentity();
+	gluLookAt(-2.0, 2.0, 10.0, 0.0, 0.0, 0.0, 0.0, 1.0, 0.0);
+
+	if(view->instances)
+	{
+		view->instances->num_instances = 0;
+
+		for (i = 0; i < piece->shape->height; i++)
+			for (j = 0; j < piece->shape->width; j++)
+				if(blocksPieceCell(piece, j, i))
+					blocksAddInstance(view->instances,
+					                  -(piece->shape->width / 2.0) + 0.5 + 1.0 * j,
+					                  (piece->shape->height / 2.0) - 0.5 - 1.0 * i,
+					                  0.0, 1.0, piece->color);
+
+		blocksDrawInstances(view->instances);
+		return;
+	}
+
+	for (i = 0; i < piece->shape->height; i++)
+	{
+		for (j = 0; j < piece->shape->width; j++)
+		{
+			glPushMatrix();
+			glTranslatef(-(piece->shape->width / 2.0) + 0.5 + 1.0 * j,
+			             (piece->shape->height / 2.0) - 0.5 - 1.0 * i,
+			             0.0);
+
+			if(blocksPieceCell(piece, j, i))
+			{
+				glColor3ub(piece->color.r, piece->color.g, piece->color.b);
+				drawSolidCube(1.0);
+
+				glColor3ub(0, 0, 0);
+				drawWireCube(1.0);
+			}
+
+			glPopMatrix();
+		}
+	}
+}
+
+void blocksDrawWell(BlocksView *view, const BlocksWell *well, double elapsed)
+{
+	int i, y;
+	GLfloat position[3];
+	const Polycube *piece = well->current_piece;
+	Color white = {255, 255, 255};
+	double turn = elapsed / view->rotation_speed;
+
+	// tilted to look down into the well, then turned as the camera of a game is
+
+	glLoadIdentity();
+	gluLookAt(-2.0, 2.0, 10.0, 0.0, 0.0, 0.0, 0.0, 1.0, 0.0);
+	glRotated(25.0, 1.0, 0.0, 0.0);
+	glRotated(view->rotation_delta[0] * turn, 1.0, 0.0, 0.0);
+	glRotated(view->rotation_delta[1] * turn, 0.0, 1.0, 0.0);
+
+	// draw boundaries
+
+	glColor3ub(0, 0, 255);
+
+	glPushMatrix();
+	glTranslatef(0.0, 5.0, 0.0);
+	glScalef(well->width, well->height - BLOCKS_BUFFER_HEIGHT, well->depth);
+
+	drawWireCube(10.0);
+	glPopMatrix();
+
+	// draw cubes, the locked ones only found again after a piece has been
+	// locked, by taking the set bits of each layer
+
+	if(view->board_pieces != well->pieces_placed)
+	{
+		if(view->instances)
+			view->instances->num_instances = 0;
+		else
+		{
+			if(!view->board_list)
+				view->board_list = glGenLists(1);
+
+			glNewList(view->board_list, GL_COMPILE);
+		}
+
+		for (y = BLOCKS_BUFFER_HEIGHT; y < well->height; y++)
+		{
+			BlocksLayer layer;
+
+			for (layer = well->layers[y]; layer; layer &= layer - 1)
+			{
+				int cell = __builtin_ctzll(layer);
+
+				drawWellCube(view, well, cell % well->width, y, cell / well->width, white);
+			}
+		}
+
+		if(view->instances)
+			view->board_instances = view->instances->num_instances;
+		else
+			glEndList();
+
+		view->board_pieces = well->pieces_placed;
+	}
+
+	if(view->instances)
+		view->instances->num_instances = view->board_instances;
+	else
+		glCallList(view->board_list);
+
+	// draw piece
+
+	for (i = 0; i < BLOCKS_POLYCUBE_SIZE && !well->game_over; i++)
+	{
+		const int8_t *cell = piece->cells[i];
+
+		if(piece->position[AXIS_Y] + cell[AXIS_Y] >= BLOCKS_BUFFER_HEIGHT)
+			drawWellCube(view, well, piece->position[AXIS_X] + cell[AXIS_X], piece->position[AXIS_Y] + cell[AXIS_Y],
+			             piece->position[AXIS_Z] + cell[AXIS_Z], piece->color);
+	}
+
+	if(view->instances)
+		blocksDrawInstances(view->instances);
+
+	// draw ghost piece where the piece would land
+
+	int landing_layer = blocksWellLandingLayer(well);
+
+	for (i = 0; i < BLOCKS_POLYCUBE_SIZE && !well->game_over && landing_layer != piece->position[AXIS_Y]; i++)
+	{
+		const int8_t *cell = piece->cells[i];
+
+		y = landing_layer + cell[AXIS_Y];
+
+		if(y < BLOCKS_BUFFER_HEIGHT)
+			continue;
+
+		drawWellPosition(well, piece->position[AXIS_X] + cell[AXIS_X], y, piece->position[AXIS_Z] + cell[AXIS_Z], position);
+
+		glPushMatrix();
+		glTranslatef(position[0], position[1], position[2]);
+
+		glColor3ub(piece->color.r, piece->color.g, piece->color.b);
+		drawWireCube(10.0);
+
+		glPopMatrix();
+	}
+
+	if(well->game_over && view->draw_text)
+	{
+		glLoadIdentity();
+		glColor3ub(255, 0, 0);
+		glRasterPos3d(-30.0, 0.0, 200.0);
+
+		view->draw_text("Game Over!");
+	}
+}
+
+void blocksDrawWellNextPiece(BlocksView *view, const BlocksWell *well)
+{
+	int i;
+	const Polycube *piece = well->next_piece;
+
+	if(well->game_over)
+		return;
+
+	// turned a little about x and y so every layer of the piece shows
+
+	glLoadIdentity();
+	gluLookAt(-2.0, 2.0, 10.0, 0.0, 0.0, 0.0, 0.0, 1.0, 0.0);
+	glRotated(25.0, 1.0, 0.0, 0.0);
+	glRotated(-30.0, 0.0, 1.0, 0.0);
+
+	if(view->instances)
+		view->instances->num_instances = 0;
+
+	for (i = 0; i < BLOCKS_POLYCUBE_SIZE; i++)
+	{
+		const int8_t *cell = piece->cells[i];
+		GLfloat x = -(piece->size[AXIS_X] / 2.0) + 0.5 + cell[AXIS_X];
+		GLfloat y = (piece->size[AXIS_Y] / 2.0) - 0.5 - cell[AXIS_Y];
+		GLfloat z = -(piece->size[AXIS_Z] / 2.0) + 0.5 + cell[AXIS_Z];
+
+		if(view->instances)
+		{
+			blocksAddInstance(view->instances, x, y, z, 1.0, piece->color);
+			continue;
+		}
+
+		glPushMatrix();
+		glTranslatef(x, y, z);
+
+		glColor3ub(piece->color.r, piece->color.g, piece->color.b);
+		drawSolidCube(1.0);
+
+		glColor3ub(0, 0, 0);
+		drawWireCube(1.0);
+
+		glPopMatrix();
+	}
+
+	if(view->instances)
+		blocksDrawInstances(view->instances);
+}
+
+static void drawInstances(BlocksView *view, const BlocksGame *game, double fall)
+{
+	int i, j;
+	const Tetromino *piece = game->current_piece;
+	InstanceRenderer *instances = view->instances;
+	Color white = {255, 255, 255};
+
+	// the locked blocks stay at the start of the instances until a piece is locked
+
+	if(view->board_pieces != game->pieces_placed)
+	{
+		instances->num_instances = 0;
+
+		for (i = BLOCKS_BUFFER_HEIGHT; i < game->height; i++)
+			for (j = 0; j < game->width; j++)
+				if(blocksCell(game, j, i))
+					blocksAddInstance(instances, -45.0 + 10.0 * j, game->height * 10.0 - 100.0 - 10.0 * i, 0.0, 10.0, white);
+
+		view->board_instances = instances->num_instances;
+		view->board_pieces = game->pieces_placed;
+	}
+
+	instances->num_instances = view->board_instances;
+
+	for (i = 0; i < piece->shape->height; i++)
+	{
+		int y = piece->position[1] + i;
+
+		for (j = 0; j < piece->shape->width; j++)
+		{
+			int x = piece->position[0] + j;
+
+			if(blocksPieceCell(piece, j, i) && y >= BLOCKS_BUFFER_HEIGHT)
+				blocksAddInstance(instances, -45.0 + 10.0 * x, game->height * 10.0 - 100.0 - 10.0 * (y + fall), 0.0, 10.0, piece->color);
+		}
+	}
+
+	blocksDrawInstances(instances);
+}
+
+static void drawCompileBoard(BlocksView *view, const BlocksGame *game)
+{
+	if(!view->mesh)
+		view->mesh = blocksNewMesh(game->width, game->height - BLOCKS_BUFFER_HEIGHT);
+
+	if(!view->board_list)
+		view->board_list = glGenLists(1);
+
+	BlocksMesh *mesh = view->mesh;
+
+	blocksBuildMesh(mesh, game);
+
+	glNewList(view->board_list, GL_COMPILE);
+
+	// the mesh is in cells, with the top left of the first row at the origin
+
+	glPushMatrix();
+	glTranslatef(-50.0, game->height * 10.0 - 95.0, -5.0);
+	glScalef(10.0, 10.0, 10.0);
+
+	glEnableClientState(GL_VERTEX_ARRAY);
+
+	glColor3ub(255, 255, 255);
+	glVertexPointer(3, GL_FLOAT, 0, mesh->quads);
+	glDrawArrays(GL_QUADS, 0, mesh->num_quads * 4);
+
+	glColor3ub(0, 0, 0);
+	glVertexPointer(3, GL_FLOAT, 0, mesh->lines);
+	glDrawArrays(GL_LINES, 0, mesh->num_lines * 2);
+
+	glDisableClientState(GL_VERTEX_ARRAY);
+
+	glPopMatrix();
+
+	glEndList();
+
+	view->board_pieces = game->pieces_placed;
+}
+
+static void drawWellPosition(const BlocksWell *well, int x, int y, int z, GLfloat position[3])
+{
+	// centered on the well, with the first layer below the buffer at the top,
+	// as a game's rows are
+
+	position[0] = -5.0 * well->width + 5.0 + 10.0 * x;
+	position[1] = 5.0 * (well->height - BLOCKS_BUFFER_HEIGHT) - 10.0 * (y - BLOCKS_BUFFER_HEIGHT);
+	position[2] = -5.0 * well->depth + 5.0 + 10.0 * z;
+}
+
+static void drawWellCube(BlocksView *view, const BlocksWell *well, int x, int y, int z, Color color)
+{
+	GLfloat position[3];
+
+	drawWellPosition(well, x, y, z, position);
+
+	if(view->instances)
+	{
+		blocksAddInstance(view->instances, position[0], position[1], position[2], 10.0, color);
+		return;
+	}
+
+	glPushMatrix();
+	glTranslatef(position[0], position[1], position[2]);
+
+	glColor3ub(color.r, color.g, color.b);
+	drawSolidCube(10.0);
+
+	glColor3ub(0, 0, 0);
+	drawWireCube(10.0);
+
+	glPopMatrix();
+}
+
+static void drawSolidCube(GLdouble size)
+{
+	int face, corner;
+	GLdouble position[3];
+
+	static const int Corners[4][2] = {{0, 0}, {1, 0}, {1, 1}, {0, 1}};
+
+	// each face along axis a is spanned by the next two axes in the order that
+	// winds it counter clockwise from outside, as in the instanced cube
+
+	glBegin(GL_QUADS);
+
+	for(face = 0; face < 6; face++)
+	{
+		int axis = face / 2;
+		int sign = face % 2 ? -1 : 1;
+		int u = sign > 0 ? (axis + 1) % 3 : (axis + 2) % 3;
+		int v = sign > 0 ? (axis + 2) % 3 : (axis + 1) % 3;
+
+		for(corner = 0; corner < 4; corner++)
+		{
+			position[axis] = 0.5 * sign * size;
+			position[u] = (Corners[corner][0] - 0.5) * size;
+			position[v] = (Corners[corner][1] - 0.5) * size;
+
+			glVertex3dv(position);
+		}
+	}
+
+	glEnd();
+}
+
+static void drawWireCube(GLdouble size)
+{
+	int axis, edge;
+	GLdouble position[3];
+
+	// four edges along each axis, at each corner of the other two
+
+	glBegin(GL_LINES);
+
+	for(axis = 0; axis < 3; axis++)
+	{
+		for(edge = 0; edge < 4; edge++)
+		{
+			position[(axis + 1) % 3] = (edge & 1 ? 0.5 : -0.5) * size;
+			position[(axis + 2) % 3] = (edge & 2 ? 0.5 : -0.5) * size;
+
+			position[axis] = -0.5 * size;
+			glVertex3dv(position);
+
+			position[axis] = 0.5 * size;
+			glVertex3dv(position);
+		}
+	}
+
+	glEnd();
+}
+
+void blocksFreeView(BlocksView *view)
+{
+	if(view->instances)
+		blocksFreeInstanceRenderer(view->instances);
+
+	if(view->board_list)
+		glDeleteLists(view->board_list, 1);
+
+	if(view->mesh)
+		blocksFreeMesh(view->mesh);
+
+	free(view);
+}
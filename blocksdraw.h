@@ -0,0 +1,88 @@
+/**
+ * blocksdraw.h
+ *
+ * OpenGL drawing of Blocks games, shared by the GLUT and offscreen frontends
+ *
+ * @author Timothy Cheeseman
+ */
+
+#ifndef _BLOCKSDRAW_H
+#define _BLOCKSDRAW_H
+
+#include "blocksloop.h"
+#include "blocksmesh.h"
+#include "blocksrender.h"
+#include "blockswell.h"
+
+/**
+ * What a view of a game draws with and keeps between frames: its instanced
+ * renderer (NULL drawing in immediate mode), the locked blocks cached since
+ * the last piece was placed, and how its camera turns. Text is drawn at the
+ * raster position with draw_text, if the frontend has a way to draw it.
+ */
+typedef struct BlocksView {
+
+	InstanceRenderer *instances;
+	int board_instances;
+
+	BlocksMesh *mesh;
+	GLuint board_list;
+	long board_pieces;
+
+	GLdouble rotation_delta[2];
+	int rotation_speed;
+
+	void (*draw_text)(const char *text);
+
+} BlocksView;
+
+/**
+ * Create a view in the current context, drawing with instances if given a
+ * renderer, which the view then owns
+ */
+BlocksView *blocksNewView(InstanceRenderer *instances);
+
+/**
+ * Forget the locked blocks cached for the last game, for starting a new one
+ */
+void blocksResetView(BlocksView *view);
+
+/**
+ * Set up the projection the game is drawn with
+ */
+void blocksGameProjection();
+
+/**
+ * Set up the projection the next piece is drawn with
+ */
+void blocksNextPieceProjection();
+
+/**
+ * Draw the well, the locked blocks, the current piece and its ghost of a
+ * snapshot, with the piece and camera interpolated to a time in ms
+ */
+void blocksDrawGame(BlocksView *view, const BlocksSnapshot *snapshot, double now);
+
+/**
+ * Draw the next piece of a game, unless the game is over
+ */
+void blocksDrawNextPiece(BlocksView *view, const BlocksGame *game);
+
+/**
+ * Draw the well, the locked cubes, the current piece and its ghost of a 3D
+ * game, looking down into the well with the camera turned as far as it has
+ * turned in elapsed ms of play
+ */
+void blocksDrawWell(BlocksView *view, const BlocksWell *well, double elapsed);
+
+/**
+ * Draw the next piece of a 3D game, unless the game is over
+ */
+void blocksDrawWellNextPiece(BlocksView *view, const BlocksWell *well);
+
+/**
+ * Free a view and its renderer, its context must be current
+ */
+void blocksFreeView(BlocksView *view);
+
+#endif /* _BLOCKSDRAW_H */
@@ -0,0 +1,393 @@
+/**
+ * blocksloop.c
+ *
+ * Fixed timestep game loop with a timestamped input queue for the Blocks library
+ *
+ * @author Timothy Cheeseman
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "blocksloop.h"
+#include "blocksprofile.h"
+
+/**
+ * Print an error to stderr and exit with EXIT_FAILURE
+ */
+static void loopError(const char *message);
+
+/**
+ * Simulate a single tick
+ */
+static void loopTick(BlocksLoop *loop);
+
+/**
+ * Make an engine call on the loop's game and record it
+ */
+static void loopCall(BlocksLoop *loop, ReplayCall call);
+
+/**
+ * Apply a key press or release
+ */
+static void loopInput(BlocksLoop *loop, const InputEvent *event);
+
+/**
+ * Move the current piece sideways once, or to the wall if all is set
+ */
+static void loopShift(BlocksLoop *loop, bool all);
+
+/**
+ * Get how far below its row the current piece of a game is drawn, given how
+ * far it has fallen and the gravity
+ */
+static double loopFallOffset(const BlocksGame *game, double fall, double gravity, double alpha);
+
+/**
+ * Copy a loop's game and timing into a snapshot
+ */
+static void loopSnapshot(const BlocksLoop *loop, BlocksSnapshot *snapshot);
+
+/**
+ * The flag set on the middle snapshot's index when it hasn't been read yet
+ */
+#define SNAPSHOT_FRESH 4
+
+static void loopError(const char *message)
+{
+	fprintf(stderr, "BLOCKS3D: %s\n", message);
+	exit(EXIT_FAILURE);
+}
+
+BlocksLoop *blocksNewLoop(BlocksGame *game, int tick_rate, double now)
+{
+	BlocksLoop *loop = malloc(sizeof(BlocksLoop));
+
+	if(!loop)
+		loopError("Error allocating memory for a game loop.");
+
+	loop->game = game;
+
+	loop->tick_length = 1000.0 / tick_rate;
+	loop->start = now;
+	loop->tick = 0;
+
+	// one row a second, a quarter second before keys repeat and then 30 moves a second
+
+	loop->gravity = 1.0 / tick_rate;
+	loop->fall = 0.0;
+
+	loop->das = tick_rate / 4;
+	loop->arr = tick_rate / 30;
+
+	loop->shift = INPUT_LEFT;
+	loop->shifting = false;
+	loop->shift_ticks = 0;
+
+	loop->soft_drop = false;
+	loop->soft_drop_ticks = 0;
+
+	loop->on_tick = NULL;
+	loop->data = NULL;
+
+	loop->recorder = NULL;
+
+	atomic_init(&loop->head, 0);
+	atomic_init(&loop->tail, 0);
+
+	return loop;
+}
+
+bool blocksLoopPushInput(BlocksLoop *loop, double time, Input input, bool pressed)
+{
+	unsigned int tail = atomic_load_explicit(&loop->tail, memory_order_relaxed);
+
+	// the consumer only frees slots, so a full queue can only be stale
+
+	if(tail - atomic_load_explicit(&loop->head, memory_order_acquire) == BLOCKS_INPUT_QUEUE_SIZE)
+		return false;
+
+	InputEvent *event = &loop->queue[tail % BLOCKS_INPUT_QUEUE_SIZE];
+
+	event->time = time;
+	event->input = input;
+	event->pressed = pressed;
+
+	atomic_store_explicit(&loop->tail, tail + 1, memory_order_release);
+
+	return true;
+}
+
+void blocksLoopApplyInput(BlocksLoop *loop, Input input)
+{
+	loopCall(loop, (ReplayCall) input);
+}
+
+int blocksLoopAdvance(BlocksLoop *loop, double now, int max_ticks)
+{
+	int ticks = 0;
+
+	while(blocksLoopNextTick(loop) <= now)
+	{
+		if(ticks == max_ticks)
+		{
+			blocksLoopRebase(loop, now);
+			break;
+		}
+
+		loopTick(loop);
+		ticks++;
+	}
+
+	return ticks;
+}
+
+void blocksLoopRebase(BlocksLoop *loop, double now)
+{
+	loop->start = now - loop->tick * loop->tick_length;
+}
+
+double blocksLoopNextTick(const BlocksLoop *loop)
+{
+	return loop->start + (loop->tick + 1) * loop->tick_length;
+}
+
+double blocksLoopAlpha(const BlocksLoop *loop, double now)
+{
+	double alpha = (now - (loop->start + loop->tick * loop->tick_length)) / loop->tick_length;
+
+	if(alpha < 0.0)
+		return 0.0;
+
+	return alpha < 1.0 ? alpha : 1.0;
+}
+
+double blocksLoopFallOffset(const BlocksLoop *loop, double alpha)
+{
+	return loopFallOffset(loop->game, loop->fall, loop->gravity, alpha);
+}
+
+static double loopFallOffset(const BlocksGame *game, double fall, double gravity, double alpha)
+{
+	const Tetromino *piece = game->current_piece;
+
+	// a piece resting on the stack is about to lock, not fall
+
+	if(game->game_over || blocksShapeCollision(game, piece->shape, piece->position[0], piece->position[1] + 1))
+		return 0.0;
+
+	double offset = fall + gravity * alpha;
+
+	return offset < 1.0 ? offset : 1.0;
+}
+
+static void loopTick(BlocksLoop *loop)
+{
+	BlocksGame *game = loop->game;
+	long pieces = game->pieces_placed;
+	double end = blocksLoopNextTick(loop);
+
+	BLOCKS_PROFILE_BEGIN(PROFILE_TICK);
+
+	if(loop->on_tick)
+		loop->on_tick(loop, loop->data);
+
+	// apply the inputs that happened during this tick in the order they happened
+
+	unsigned int head = atomic_load_explicit(&loop->head, memory_order_relaxed);
+	unsigned int tail = atomic_load_explicit(&loop->tail, memory_order_acquire);
+
+	for (; head != tail && loop->queue[head % BLOCKS_INPUT_QUEUE_SIZE].time <= end; head++)
+	{
+		BLOCKS_PROFILE_BEGIN(PROFILE_INPUT);
+		loopInput(loop, &loop->queue[head % BLOCKS_INPUT_QUEUE_SIZE]);
+		BLOCKS_PROFILE_END(PROFILE_INPUT);
+	}
+
+	atomic_store_explicit(&loop->head, head, memory_order_release);
+
+	// repeat held keys
+
+	if(loop->shifting && ++loop->shift_ticks >= loop->das)
+	{
+		if(!loop->arr)
+			loopShift(loop, true);
+		else if((loop->shift_ticks - loop->das) % loop->arr == 0)
+			loopShift(loop, false);
+	}
+
+	if(loop->soft_drop && ++loop->soft_drop_ticks % (loop->arr ? loop->arr : 1) == 0)
+		loopCall(loop, REPLAY_DOWN);
+
+	// gravity, stopping at the first row the piece locks on
+
+	BLOCKS_PROFILE_BEGIN(PROFILE_GRAVITY);
+
+	loop->fall += loop->gravity;
+
+	while(loop->fall >= 1.0 && !game->game_over && game->pieces_placed == pieces)
+	{
+		loop->fall -= 1.0;
+		loopCall(loop, REPLAY_GRAVITY);
+	}
+
+	// a new piece starts from the top of its row
+
+	if(game->pieces_placed != pieces)
+		loop->fall = 0.0;
+
+	BLOCKS_PROFILE_END(PROFILE_GRAVITY);
+
+	loop->tick++;
+
+	BLOCKS_PROFILE_END(PROFILE_TICK);
+}
+
+static void loopCall(BlocksLoop *loop, ReplayCall call)
+{
+	// calls after the game is over change nothing, so they aren't recorded
+
+	if(loop->recorder && !loop->game->game_over)
+		blocksRecordCall(loop->recorder, loop->tick, call);
+
+	if(call == REPLAY_GRAVITY)
+		blocksMovePiece(loop->game, DIRECTION_DOWN);
+	else
+		blocksApplyInput(loop->game, (Input) call);
+}
+
+static void loopInput(BlocksLoop *loop, const InputEvent *event)
+{
+	switch (event->input)
+	{
+		case INPUT_LEFT:
+		case INPUT_RIGHT:
+			if(event->pressed)
+			{
+				loop->shift = event->input;
+				loop->shifting = true;
+				loop->shift_ticks = 0;
+
+				loopShift(loop, false);
+			}
+			else if(loop->shift == event->input)
+				loop->shifting = false;
+			break;
+		case INPUT_DOWN:
+			loop->soft_drop = event->pressed;
+			loop->soft_drop_ticks = 0;
+
+			if(event->pressed)
+				loopCall(loop, REPLAY_DOWN);
+			break;
+		default:
+			if(event->pressed)
+				loopCall(loop, (ReplayCall) event->input);
+			break;
+	}
+}
+
+static void loopShift(BlocksLoop *loop, bool all)
+{
+	int x;
+	Tetromino *piece = loop->game->current_piece;
+
+	do
+	{
+		x = piece->position[0];
+		loopCall(loop, (ReplayCall) loop->shift);
+	}
+	while(all && piece->position[0] != x);
+}
+
+void blocksFreeLoop(BlocksLoop *loop)
+{
+	free(loop);
+}
+
+BlocksSnapshots *blocksNewSnapshots(const BlocksLoop *loop)
+{
+	int i;
+	BlocksSnapshots *snapshots = malloc(sizeof(BlocksSnapshots));
+
+	if(!snapshots)
+		loopError("Error allocating memory for snapshots.");
+
+	// each copy of the game on its own cache lines
+
+	size_t stride = (loop->game->size + 63) & ~(size_t) 63;
+
+	snapshots->storage = aligned_alloc(64, 3 * stride);
+
+	if(!snapshots->storage)
+		loopError("Error allocating memory for snapshots.");
+
+	for(i = 0; i < 3; i++)
+	{
+		snapshots->snapshots[i].game = (BlocksGame *) ((char *) snapshots->storage + i * stride);
+		loopSnapshot(loop, &snapshots->snapshots[i]);
+		snapshots->snapshots[i].dirty = DIRTY_ALL;
+	}
+
+	snapshots->back = 0;
+	snapshots->pending = 0;
+	atomic_init(&snapshots->middle, 1);
+	snapshots->front = 2;
+
+	return snapshots;
+}
+
+void blocksLoopPublish(BlocksLoop *loop, BlocksSnapshots *snapshots)
+{
+	BlocksSnapshot *snapshot = &snapshots->snapshots[snapshots->back];
+	unsigned int dirty = blocksTakeDirty(loop->game);
+
+	BLOCKS_PROFILE_BEGIN(PROFILE_PUBLISH);
+
+	loopSnapshot(loop, snapshot);
+	snapshot->dirty = snapshots->pending | dirty;
+
+	// swap the snapshot in for the middle one, and if that was never read
+	// carry its changes over to the next snapshot as well
+
+	unsigned int middle = atomic_exchange_explicit(&snapshots->middle, snapshots->back | SNAPSHOT_FRESH,
+	                                               memory_order_acq_rel);
+
+	snapshots->back = middle & ~SNAPSHOT_FRESH;
+	snapshots->pending = middle & SNAPSHOT_FRESH ? snapshot->dirty : dirty;
+
+	BLOCKS_PROFILE_END(PROFILE_PUBLISH);
+}
+
+const BlocksSnapshot *blocksReadSnapshot(BlocksSnapshots *snapshots, bool *fresh)
+{
+	*fresh = atomic_load_explicit(&snapshots->middle, memory_order_relaxed) & SNAPSHOT_FRESH;
+
+	if(*fresh)
+		snapshots->front = atomic_exchange_explicit(&snapshots->middle, snapshots->front,
+		                                            memory_order_acq_rel) & ~SNAPSHOT_FRESH;
+
+	return &snapshots->snapshots[snapshots->front];
+}
+
+static void loopSnapshot(const BlocksLoop *loop, BlocksSnapshot *snapshot)
+{
+	blocksCloneGame(loop->game, snapshot->game);
+
+	snapshot->tick = loop->tick;
+	snapshot->tick_start = loop->start + loop->tick * loop->tick_length;
+	snapshot->tick_length = loop->tick_length;
+	snapshot->fall = loop->fall;
+	snapshot->gravity = loop->gravity;
+}
+
+double blocksSnapshotFallOffset(const BlocksSnapshot *snapshot, double alpha)
+{
+	return loopFallOffset(snapshot->game, snapshot->fall, snapshot->gravity, alpha);
+}
+
+void blocksFreeSnapshots(BlocksSnapshots *snapshots)
+{
+	free(snapshots->storage);
+	free(snapshots);
+}
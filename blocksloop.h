@@ -0,0 +1,207 @@
+/**
+ * blocksloop.h
+ *
+ * Fixed timestep game loop with a timestamped input queue for the Blocks library
+ *
+ * @author Timothy Cheeseman
+ */
+
+#ifndef _BLOCKSLOOP_H
+#define _BLOCKSLOOP_H
+
+#include <stdatomic.h>
+
+#include "blocks.h"
+#include "blocksreplay.h"
+
+/**
+ * The default number of simulation ticks per second
+ */
+#define BLOCKS_TICK_RATE 60
+
+/**
+ * The number of input events a loop can hold before they are simulated
+ */
+#define BLOCKS_INPUT_QUEUE_SIZE 256
+
+/**
+ * A key press or release at a time in ms
+ */
+typedef struct InputEvent {
+
+	double time;
+	Input input;
+	bool pressed;
+
+} InputEvent;
+
+/**
+ * Game loop simulating a blocks game in fixed ticks. Queued inputs are applied
+ * in the tick their time falls in, so the same events always give the same
+ * game whatever the frame rate. Held left and right keys repeat after das
+ * ticks and then every arr ticks (0 moving to the wall at once), a held down
+ * key repeats every arr ticks, and gravity moves the piece down by gravity
+ * rows per tick, which can be more than one.
+ *
+ * The input queue is a lock free single producer, single consumer ring, so one
+ * thread can push inputs while another runs the loop.
+ *
+ * Every engine call the loop makes is recorded by recorder, if it has one.
+ */
+typedef struct BlocksLoop {
+
+	BlocksGame *game;
+
+	double tick_length;
+	double start;
+	long tick;
+
+	double gravity;
+	double fall;
+
+	int das;
+	int arr;
+
+	Input shift;
+	bool shifting;
+	long shift_ticks;
+
+	bool soft_drop;
+	long soft_drop_ticks;
+
+	void (*on_tick)(struct BlocksLoop *loop, void *data);
+	void *data;
+
+	BlocksRecorder *recorder;
+
+	_Alignas(64) _Atomic unsigned int head;
+	_Alignas(64) _Atomic unsigned int tail;
+	InputEvent queue[BLOCKS_INPUT_QUEUE_SIZE];
+
+} BlocksLoop;
+
+/**
+ * An immutable copy of a game as it was after a tick, with what is needed to
+ * interpolate it to a later time and the parts of the game that changed since
+ * the last snapshot read (BlocksDirty flags)
+ */
+typedef struct BlocksSnapshot {
+
+	BlocksGame *game;
+
+	long tick;
+	double tick_start;
+	double tick_length;
+
+	double fall;
+	double gravity;
+
+	unsigned int dirty;
+
+} BlocksSnapshot;
+
+/**
+ * Lock free triple buffer of snapshots, one published by the thread running a
+ * loop and read by one other thread. Neither thread ever waits on the other:
+ * the writer always has a spare buffer to write, and the reader keeps the
+ * snapshot it last read until it asks for a newer one.
+ */
+typedef struct BlocksSnapshots {
+
+	BlocksSnapshot snapshots[3];
+	void *storage;
+
+	int back;
+	unsigned int pending;
+
+	_Alignas(64) _Atomic unsigned int middle;
+
+	_Alignas(64) int front;
+
+} BlocksSnapshots;
+
+/**
+ * Create a loop for a game ticking tick_rate times a second, the first tick
+ * ending one tick after now (in ms)
+ */
+BlocksLoop *blocksNewLoop(BlocksGame *game, int tick_rate, double now);
+
+/**
+ * Queue a key press or release, times must not go backwards
+ *
+ * Returns false if the queue is full and the event was dropped.
+ */
+bool blocksLoopPushInput(BlocksLoop *loop, double time, Input input, bool pressed);
+
+/**
+ * Apply an input to a loop's game straight away, from its on_tick callback,
+ * recording it with the loop's recorder
+ */
+void blocksLoopApplyInput(BlocksLoop *loop, Input input);
+
+/**
+ * Run every tick that ends at or before now, at most max_ticks of them, and
+ * move the loop's clock forward past the rest so a long stall isn't caught up on
+ *
+ * Returns the number of ticks run.
+ */
+int blocksLoopAdvance(BlocksLoop *loop, double now, int max_ticks);
+
+/**
+ * Move the loop's clock so the next tick ends one tick after now, for resuming
+ * after a pause without catching up on it
+ */
+void blocksLoopRebase(BlocksLoop *loop, double now);
+
+/**
+ * Get the time in ms the next tick ends at
+ */
+double blocksLoopNextTick(const BlocksLoop *loop);
+
+/**
+ * Get how far the time now is through the current tick, from 0 to 1, for
+ * interpolating what is drawn between ticks
+ */
+double blocksLoopAlpha(const BlocksLoop *loop, double now);
+
+/**
+ * Get how far below its row the current piece should be drawn in rows, by
+ * interpolating gravity a fraction alpha through the current tick
+ */
+double blocksLoopFallOffset(const BlocksLoop *loop, double alpha);
+
+/**
+ * Free the memory used by a loop, but not its game
+ */
+void blocksFreeLoop(BlocksLoop *loop);
+
+/**
+ * Create a triple buffer of snapshots of a loop's game, every snapshot starting
+ * as a copy of the game as it is now
+ */
+BlocksSnapshots *blocksNewSnapshots(const BlocksLoop *loop);
+
+/**
+ * Publish a snapshot of a loop's game from the thread running the loop, taking
+ * the game's dirty flags
+ */
+void blocksLoopPublish(BlocksLoop *loop, BlocksSnapshots *snapshots);
+
+/**
+ * Get the latest snapshot published, setting fresh if it wasn't the one last
+ * read. The snapshot stays valid until the next call.
+ */
+const BlocksSnapshot *blocksReadSnapshot(BlocksSnapshots *snapshots, bool *fresh);
+
+/**
+ * Get how far below its row the current piece of a snapshot should be drawn
+ * in rows, a fraction alpha through the tick after it
+ */
+double blocksSnapshotFallOffset(const BlocksSnapshot *snapshot, double alpha);
+
+/**
+ * Free the memory used by a triple buffer of snapshots
+ */
+void blocksFreeSnapshots(BlocksSnapshots *snapshots);
+
+#endif /* _BLOCKSLOOP_H */
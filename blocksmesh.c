@@ -0,0 +1,234 @@
+/**
+ * blocksmesh.c
+ *
+ * Board mesh generation for the Blocks library
+ *
+ * @author Timothy Cheeseman
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "blocksmesh.h"
+
+/**
+ * Print an error to stderr and exit with EXIT_FAILURE
+ */
+static void meshError(const char *message);
+
+/**
+ * Add a quad from an origin along two edges, facing the direction of u x v
+ */
+static void meshQuad(BlocksMesh *mesh, float x, float y, float z, const float u[3], const float v[3]);
+
+/**
+ * Add a line between two points
+ */
+static void meshLine(BlocksMesh *mesh, float x0, float y0, float z0, float x1, float y1, float z1);
+
+/**
+ * Take the lowest run of consecutive set bits from a row, returning its first
+ * column and the mask of its bits
+ */
+static inline BlocksRow meshRun(BlocksRow bits, int *first, int *length)
+{
+	BlocksRow shifted = bits >> __builtin_ctzll(bits);
+
+	*first = __builtin_ctzll(bits);
+	*length = ~shifted ? __builtin_ctzll(~shifted) : 64 - *first;
+
+	return *length == 64 ? ~(BlocksRow) 0 : (((BlocksRow) 1 << *length) - 1) << *first;
+}
+
+static void meshError(const char *message)
+{
+	fprintf(stderr, "BLOCKS3D: %s\n", message);
+	exit(EXIT_FAILURE);
+}
+
+BlocksMesh *blocksNewMesh(int width, int height)
+{
+	BlocksMesh *mesh = malloc(sizeof(BlocksMesh));
+
+	if(!mesh)
+		meshError("Error allocating memory for a mesh.");
+
+	if(width > BLOCKS_NARROW_WIDTH)
+		meshError("Meshes can only be built for games up to 64 columns wide.");
+
+	mesh->width = width;
+	mesh->height = height + BLOCKS_BUFFER_HEIGHT;
+
+	// every cell adds at most a front, a back and four side quads, and ends at
+	// most two runs of faces in each direction
+
+	size_t cells = (size_t) width * mesh->height;
+
+	mesh->num_quads = 0;
+	mesh->quads = malloc(6 * cells * 4 * 3 * sizeof(float));
+	mesh->num_lines = 0;
+	mesh->lines = malloc(12 * cells * 2 * 3 * sizeof(float));
+	mesh->visited = malloc(mesh->height * sizeof(BlocksRow));
+
+	if(!mesh->quads || !mesh->lines || !mesh->visited)
+		meshError("Error allocating memory for a mesh.");
+
+	return mesh;
+}
+
+void blocksBuildMesh(BlocksMesh *mesh, const BlocksGame *game)
+{
+	int x, y, first, length;
+	int top = BLOCKS_BUFFER_HEIGHT;
+	int height = game->height;
+	const BlocksRow *rows = game->rows;
+
+	static const float Z[3] = {0, 0, 1};
+
+	if(game->width != mesh->width || game->height != mesh->height)
+		meshError("Building the mesh of a game of a different size.");
+
+	mesh->num_quads = 0;
+	mesh->num_lines = 0;
+
+	memset(mesh->visited, 0, height * sizeof(BlocksRow));
+
+	for(y = top; y < height; y++)
+	{
+		BlocksRow above = y > top ? rows[y - 1] : 0;
+		BlocksRow below = y + 1 < height ? rows[y + 1] : 0;
+		BlocksRow run;
+
+		// the front and back are covered by rectangles grown from the widest
+		// run of a row down through every row that has the same run free
+
+		for(BlocksRow free = rows[y] & ~mesh->visited[y]; free; free &= ~run)
+		{
+			int bottom = y + 1;
+
+			run = meshRun(free, &first, &length);
+
+			while(bottom < height && (rows[bottom] & ~mesh->visited[bottom] & run) == run)
+				mesh->visited[bottom++] |= run;
+
+			float u[3] = {length, 0, 0};
+			float v[3] = {0, bottom - y, 0};
+
+			meshQuad(mesh, first, -bottom, 1, u, v);
+			meshQuad(mesh, first, -bottom, 0, v, u);
+		}
+
+		// tops and bottoms are uncovered runs of a row, and their ends are where
+		// the silhouette turns a corner
+
+		for(BlocksRow exposed = rows[y] & ~above; exposed; exposed &= ~run)
+		{
+			run = meshRun(exposed, &first, &length);
+
+			float v[3] = {length, 0, 0};
+
+			meshQuad(mesh, first, -y, 0, Z, v);
+			meshLine(mesh, first, -y, 0, first + length, -y, 0);
+			meshLine(mesh, first, -y, 1, first + length, -y, 1);
+			meshLine(mesh, first, -y, 0, first, -y, 1);
+			meshLine(mesh, first + length, -y, 0, first + length, -y, 1);
+		}
+
+		for(BlocksRow exposed = rows[y] & ~below; exposed; exposed &= ~run)
+		{
+			run = meshRun(exposed, &first, &length);
+
+			float u[3] = {length, 0, 0};
+
+			meshQuad(mesh, first, -y - 1, 0, u, Z);
+			meshLine(mesh, first, -y - 1, 0, first + length, -y - 1, 0);
+			meshLine(mesh, first, -y - 1, 1, first + length, -y - 1, 1);
+			meshLine(mesh, first, -y - 1, 0, first, -y - 1, 1);
+			meshLine(mesh, first + length, -y - 1, 0, first + length, -y - 1, 1);
+		}
+
+		// the left and right sides are merged down each column, starting where
+		// a side is exposed that wasn't in the row above
+
+		BlocksRow left = rows[y] & ~(rows[y] << 1);
+		BlocksRow right = rows[y] & ~(rows[y] >> 1);
+		BlocksRow left_above = above & ~(above << 1);
+		BlocksRow right_above = above & ~(above >> 1);
+
+		for(BlocksRow start = left & ~left_above; start; start &= start - 1)
+		{
+			int bottom = y + 1;
+
+			x = __builtin_ctzll(start);
+
+			while(bottom < height && ((rows[bottom] & ~(rows[bottom] << 1)) >> x & 1))
+				bottom++;
+
+			float v[3] = {0, bottom - y, 0};
+
+			meshQuad(mesh, x, -bottom, 0, Z, v);
+			meshLine(mesh, x, -bottom, 0, x, -y, 0);
+			meshLine(mesh, x, -bottom, 1, x, -y, 1);
+		}
+
+		for(BlocksRow start = right & ~right_above; start; start &= start - 1)
+		{
+			int bottom = y + 1;
+
+			x = __builtin_ctzll(start);
+
+			while(bottom < height && ((rows[bottom] & ~(rows[bottom] >> 1)) >> x & 1))
+				bottom++;
+
+			float u[3] = {0, bottom - y, 0};
+
+			meshQuad(mesh, x + 1, -bottom, 0, u, Z);
+			meshLine(mesh, x + 1, -bottom, 0, x + 1, -y, 0);
+			meshLine(mesh, x + 1, -bottom, 1, x + 1, -y, 1);
+		}
+	}
+}
+
+static void meshQuad(BlocksMesh *mesh, float x, float y, float z, const float u[3], const float v[3])
+{
+	float *vertex = &mesh->quads[mesh->num_quads++ * 12];
+
+	vertex[0] = x;
+	vertex[1] = y;
+	vertex[2] = z;
+
+	vertex[3] = x + u[0];
+	vertex[4] = y + u[1];
+	vertex[5] = z + u[2];
+
+	vertex[6] = x + u[0] + v[0];
+	vertex[7] = y + u[1] + v[1];
+	vertex[8] = z + u[2] + v[2];
+
+	vertex[9] = x + v[0];
+	vertex[10] = y + v[1];
+	vertex[11] = z + v[2];
+}
+
+static void meshLine(BlocksMesh *mesh, float x0, float y0, float z0, float x1, float y1, float z1)
+{
+	float *vertex = &mesh->lines[mesh->num_lines++ * 6];
+
+	vertex[0] = x0;
+	vertex[1] = y0;
+	vertex[2] = z0;
+
+	vertex[3] = x1;
+	vertex[4] = y1;
+	vertex[5] = z1;
+}
+
+void blocksFreeMesh(BlocksMesh *mesh)
+{
+	free(mesh->quads);
+	free(mesh->lines);
+	free(mesh->visited);
+
+	free(mesh);
+}
@@ -0,0 +1,54 @@
+/**
+ * blocksmesh.h
+ *
+ * Board mesh generation for the Blocks library
+ *
+ * @author Timothy Cheeseman
+ */
+
+#ifndef _BLOCKSMESH_H
+#define _BLOCKSMESH_H
+
+#include "blocks.h"
+
+/**
+ * The locked blocks of a game as a surface of quads and an outline of lines.
+ *
+ * Coordinates are in cells: the cell at column x and row y spans x to x + 1
+ * along X, -y - 1 to -y along Y (rows go down the screen) and 0 to 1 along Z.
+ * Each quad is four vertices of three floats, counter clockwise when seen from
+ * outside, and each line is two vertices.
+ */
+typedef struct BlocksMesh {
+
+	int width;
+	int height;
+
+	int num_quads;
+	float *quads;
+
+	int num_lines;
+	float *lines;
+
+	BlocksRow *visited;
+
+} BlocksMesh;
+
+/**
+ * Create a mesh for games of a given size
+ */
+BlocksMesh *blocksNewMesh(int width, int height);
+
+/**
+ * Build the mesh of the locked blocks in the visible rows of a game, with only
+ * the faces not shared between blocks merged into as few quads as possible and
+ * an outline along the edges of the stack's silhouette
+ */
+void blocksBuildMesh(BlocksMesh *mesh, const BlocksGame *game);
+
+/**
+ * Free the memory used by a mesh
+ */
+void blocksFreeMesh(BlocksMesh *mesh);
+
+#endif /* _BLOCKSMESH_H */
@@ -0,0 +1,309 @@
+/**
+ * blocksmoves.c
+ *
+ * Placement move generator for the Blocks library
+ *
+ * @author Timothy Cheeseman
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "blocksmoves.h"
+
+/**
+ * The number of distinct shapes of each tetromino type, rotations this many
+ * turns apart give exactly the same cells
+ */
+static const int RotationPeriods[BLOCKS_NUM_TETROMINOES] = {
+	2, // I
+	4, // J
+	4, // L
+	1, // O
+	2, // S
+	2, // Z
+	4 // T
+};
+
+/**
+ * Print an error to stderr and exit with EXIT_FAILURE
+ */
+static void movesError(const char *message);
+
+/**
+ * Find the columns where each rotation of a piece fits in each row of a game
+ */
+static void movesFindFits(MoveGenerator *generator, const BlocksGame *game, const TetrominoShape *shapes);
+
+/**
+ * Get the state index of a piece at column x and row y in a rotation
+ */
+static inline int movesState(const MoveGenerator *generator, int x, int y, int rotation)
+{
+	return ((y * generator->width) + x) * BLOCKS_NUM_ROTATIONS + rotation;
+}
+
+/**
+ * Check if the state of a piece at column x and row y in a rotation was reached
+ * in a given number of inputs
+ */
+static inline bool movesReachedIn(const MoveGenerator *generator, int x, int y, int rotation, int distance)
+{
+	return x >= 0 && x < generator->width && y >= 0 &&
+	       ((generator->reached[rotation * generator->height + y] >> x) & 1) &&
+	       generator->distance[movesState(generator, x, y, rotation)] == distance;
+}
+
+static void movesError(const char *message)
+{
+	fprintf(stderr, "BLOCKS3D: %s\n", message);
+	exit(EXIT_FAILURE);
+}
+
+MoveGenerator *blocksNewMoveGenerator(int width, int height)
+{
+	MoveGenerator *generator = malloc(sizeof(MoveGenerator));
+
+	if(!generator)
+		movesError("Error allocating memory for a move generator.");
+
+	if(width > BLOCKS_NARROW_WIDTH)
+		movesError("Moves can only be generated for games up to 64 columns wide.");
+
+	generator->width = width;
+	generator->height = height + BLOCKS_BUFFER_HEIGHT;
+	generator->num_states = width * generator->height * BLOCKS_NUM_ROTATIONS;
+
+	size_t sets = BLOCKS_NUM_ROTATIONS * generator->height * sizeof(BlocksRow);
+
+	generator->fits = malloc(sets);
+	generator->reached = malloc(sets);
+	generator->frontier = calloc(1, sets);
+	generator->next_frontier = calloc(1, sets);
+	generator->distance = malloc(generator->num_states * sizeof(uint32_t));
+	generator->placements = malloc(generator->num_states * sizeof(Placement));
+	generator->num_placements = 0;
+
+	if(!generator->fits || !generator->reached || !generator->frontier || !generator->next_frontier ||
+	   !generator->distance || !generator->placements)
+		movesError("Error allocating memory for a move generator.");
+
+	return generator;
+}
+
+int blocksGenerateMoves(MoveGenerator *generator, const BlocksGame *game)
+{
+	int distance, rotation, y;
+	int height = generator->height;
+
+	generator->num_placements = 0;
+
+	if(game->game_over)
+		return 0;
+
+	if(game->width != generator->width || game->height != generator->height)
+		movesError("Generating moves for a game of a different size.");
+
+	const Tetromino *piece = game->current_piece;
+	int period = RotationPeriods[piece->type];
+	int x = piece->position[0];
+	int top = piece->position[1];
+	int bottom = top;
+
+	generator->type = piece->type;
+	generator->period = period;
+
+	memset(generator->reached, 0, period * height * sizeof(BlocksRow));
+	movesFindFits(generator, game, TetrominoShapes[piece->type]);
+
+	rotation = piece->rotation % period;
+	generator->reached[rotation * height + top] = (BlocksRow) 1 << x;
+	generator->frontier[rotation * height + top] = (BlocksRow) 1 << x;
+	generator->distance[movesState(generator, x, top, rotation)] = 0;
+
+	// breadth first search, taking one input at a time from every state in the
+	// frontier at once, so every state is reached by a shortest path. The
+	// frontier spans rows top to bottom and only grows down by a row per input.
+
+	for(distance = 1; top <= bottom; distance++)
+	{
+		int next_top = height;
+		int next_bottom = -1;
+		int last = bottom + 1 < height ? bottom + 1 : bottom;
+
+		for(rotation = 0; rotation < period; rotation++)
+		{
+			const BlocksRow *frontier = &generator->frontier[rotation * height];
+			const BlocksRow *previous = &generator->frontier[(rotation ? rotation - 1 : period - 1) * height];
+			const BlocksRow *fits = &generator->fits[rotation * height];
+			BlocksRow *reached = &generator->reached[rotation * height];
+			BlocksRow *next = &generator->next_frontier[rotation * height];
+
+			for(y = top; y <= last; y++)
+			{
+				// states one move left, right, down or one rotation from the frontier
+
+				BlocksRow found = frontier[y] << 1 | frontier[y] >> 1 | previous[y];
+
+				if(y > 0)
+					found |= frontier[y - 1];
+
+				found &= fits[y] & ~reached[y];
+
+				next[y] = found;
+
+				if(!found)
+					continue;
+
+				reached[y] |= found;
+
+				if(y < next_top)
+					next_top = y;
+
+				if(y > next_bottom)
+					next_bottom = y;
+
+				for(; found; found &= found - 1)
+					generator->distance[movesState(generator, __builtin_ctzll(found), y, rotation)] = distance;
+			}
+		}
+
+		// empty the old frontier so both buffers stay clear outside their rows
+
+		for(rotation = 0; rotation < period; rotation++)
+			memset(&generator->frontier[rotation * height + top], 0, (bottom - top + 1) * sizeof(BlocksRow));
+
+		BlocksRow *swap = generator->frontier;
+		generator->frontier = generator->next_frontier;
+		generator->next_frontier = swap;
+
+		top = next_top;
+		bottom = next_bottom;
+	}
+
+	// a reached state is a placement when the piece can't move down from it
+
+	for(rotation = 0; rotation < period; rotation++)
+	{
+		const BlocksRow *fits = &generator->fits[rotation * height];
+		const BlocksRow *reached = &generator->reached[rotation * height];
+
+		for(y = 0; y < height; y++)
+		{
+			BlocksRow landed = reached[y] & ~(y + 1 < height ? fits[y + 1] : 0);
+
+			for(; landed; landed &= landed - 1)
+			{
+				Placement *placement = &generator->placements[generator->num_placements++];
+
+				placement->x = __builtin_ctzll(landed);
+				placement->y = y;
+				placement->rotation = rotation;
+				placement->path_length = generator->distance[movesState(generator, placement->x, y, rotation)];
+			}
+		}
+	}
+
+	return generator->num_placements;
+}
+
+static void movesFindFits(MoveGenerator *generator, const BlocksGame *game, const TetrominoShape *shapes)
+{
+	int rotation, y, i;
+
+	for(rotation = 0; rotation < generator->period; rotation++)
+	{
+		const TetrominoShape *shape = &shapes[rotation];
+		BlocksRow *fits = &generator->fits[rotation * generator->height];
+
+		// columns where the piece stays inside the board
+
+		BlocksRow inside = ((BlocksRow) 2 << (game->width - shape->width)) - 1;
+
+		for(y = 0; y + shape->height <= game->height; y++)
+		{
+			BlocksRow blocked = 0;
+
+			// a piece at column x is blocked if any of its cells lands on an occupied cell
+
+			for(i = 0; i < shape->height; i++)
+			{
+				BlocksRow mask;
+
+				for(mask = shape->mask[i]; mask; mask &= mask - 1)
+					blocked |= game->rows[y + i] >> __builtin_ctzll(mask);
+			}
+
+			fits[y] = inside & ~blocked;
+		}
+
+		for(; y < game->height; y++)
+			fits[y] = 0;
+	}
+}
+
+int blocksPlacementPath(const MoveGenerator *generator, const Placement *placement, Input *path)
+{
+	int distance;
+	int x = placement->x;
+	int y = placement->y;
+	int rotation = placement->rotation;
+
+	// walk back to the starting state, each step going to a neighbouring state
+	// that was reached with one input less, and fill the path from the end
+
+	for(distance = placement->path_length - 1; distance >= 0; distance--)
+	{
+		if(movesReachedIn(generator, x, y - 1, rotation, distance))
+		{
+			path[distance] = INPUT_DOWN;
+			y--;
+		}
+		else if(movesReachedIn(generator, x + 1, y, rotation, distance))
+		{
+			path[distance] = INPUT_LEFT;
+			x++;
+		}
+		else if(movesReachedIn(generator, x - 1, y, rotation, distance))
+		{
+			path[distance] = INPUT_RIGHT;
+			x--;
+		}
+		else
+		{
+			path[distance] = INPUT_ROTATE;
+			rotation = rotation ? rotation - 1 : generator->period - 1;
+		}
+	}
+
+	path[placement->path_length] = INPUT_DOWN;
+
+	return placement->path_length + 1;
+}
+
+void blocksApplyPlacement(BlocksGame *game, const Placement *placement)
+{
+	Tetromino *piece = game->current_piece;
+
+	piece->rotation = placement->rotation;
+	piece->shape = &TetrominoShapes[piece->type][placement->rotation];
+	piece->position[0] = placement->x;
+	piece->position[1] = placement->y;
+
+	// the piece can't move down from a placement, so this locks it
+
+	blocksMovePiece(game, DIRECTION_DOWN);
+}
+
+void blocksFreeMoveGenerator(MoveGenerator *generator)
+{
+	free(generator->fits);
+	free(generator->reached);
+	free(generator->frontier);
+	free(generator->next_frontier);
+	free(generator->distance);
+	free(generator->placements);
+
+	free(generator);
+}
@@ -0,0 +1,86 @@
+/**
+ * blocksmoves.h
+ *
+ * Placement move generator for the Blocks library
+ *
+ * @author Timothy Cheeseman
+ */
+
+#ifndef _BLOCKSMOVES_H
+#define _BLOCKSMOVES_H
+
+#include <stdint.h>
+
+#include "blocks.h"
+
+/**
+ * A final resting place of the current piece
+ */
+typedef struct Placement {
+
+	int x;
+	int y;
+	int rotation;
+	int path_length;
+
+} Placement;
+
+/**
+ * Move generator with storage for every (column, row, rotation) state of a
+ * board. The fits, reached and frontier sets hold one row bitmask per rotation
+ * and row, bit x being set for the state at column x.
+ */
+typedef struct MoveGenerator {
+
+	int width;
+	int height;
+	int num_states;
+
+	int type;
+	int period;
+
+	BlocksRow *fits;
+	BlocksRow *reached;
+	BlocksRow *frontier;
+	BlocksRow *next_frontier;
+	uint32_t *distance;
+
+	int num_placements;
+	Placement *placements;
+
+} MoveGenerator;
+
+/**
+ * Create a move generator for games of a given size
+ */
+MoveGenerator *blocksNewMoveGenerator(int width, int height);
+
+/**
+ * Find every placement the current piece of a game can reach by moving left,
+ * right, down and rotating, including under overhangs. Rotations that give the
+ * same shape (O, I, S and Z) are only reported once.
+ *
+ * Returns the number of placements found, stored in generator->placements.
+ */
+int blocksGenerateMoves(MoveGenerator *generator, const BlocksGame *game);
+
+/**
+ * Get the inputs that move the current piece to a placement, followed by the
+ * INPUT_DOWN that locks it. The path must hold path_length + 1 inputs.
+ *
+ * Returns the number of inputs written.
+ */
+int blocksPlacementPath(const MoveGenerator *generator, const Placement *placement, Input *path);
+
+/**
+ * Move the current piece of a game straight to a placement found for it and
+ * lock it there, with the same result as applying the placement's path
+ */
+void blocksApplyPlacement(BlocksGame *game, const Placement *placement);
+
+/**
+ * Free the memory used by a move generator
+ */
+void blocksFreeMoveGenerator(MoveGenerator *generator);
+
+#endif /* _BLOCKSMOVES_H */
@@ -0,0 +1,742 @@
+/**
+ * blocksoffscreen.c
+ *
+ * Offscreen Blocks renderer, drawing a game played by the computer player
+ * without a display through EGL and writing its frames to disk
+ *
+ * @author Timothy Cheeseman
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include "blocks.h"
+#include "blocksai.h"
+#include "blocksloop.h"
+#include "blocksdraw.h"
+#include "blocksrender.h"
+
+#include <GL/glext.h>
+
+/**
+ * The size of the frames, laid out as the GLUT frontend's main window
+ */
+#define OFFSCREEN_WIDTH 640
+#define OFFSCREEN_HEIGHT 480
+
+/**
+ * The number of frames waiting to be written before rendering waits for the writer
+ */
+#define OFFSCREEN_QUEUE_SIZE 4
+
+/**
+ * The number of the computer player's inputs each tick, as in the GLUT frontend
+ */
+#define OFFSCREEN_AUTOPLAY_SPEED 2
+
+/**
+ * Frame file format
+ */
+typedef enum Format {
+
+	FORMAT_NONE,
+	FORMAT_PPM,
+	FORMAT_PNG
+
+} Format;
+
+/**
+ * A frame read back from the framebuffer, bottom row first
+ */
+typedef struct OffscreenFrame {
+
+	long number;
+	unsigned char *pixels;
+
+} OffscreenFrame;
+
+/**
+ * Writer thread encoding and writing frames from a queue filled by the render
+ * loop, which only waits when the queue is full
+ */
+typedef struct OffscreenWriter {
+
+	const char *directory;
+	Format format;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t filled;
+	pthread_cond_t emptied;
+
+	OffscreenFrame frames[OFFSCREEN_QUEUE_SIZE];
+	long head;
+	long tail;
+	bool done;
+
+	unsigned char *buffer;
+	long bytes;
+	double busy;
+
+} OffscreenWriter;
+
+/**
+ * The GL entry points for asynchronous readback through pixel buffer objects,
+ * loaded at run time
+ */
+static struct {
+
+	PFNGLGENBUFFERSPROC GenBuffers;
+	PFNGLBINDBUFFERPROC BindBuffer;
+	PFNGLBUFFERDATAPROC BufferData;
+	PFNGLMAPBUFFERPROC MapBuffer;
+	PFNGLUNMAPBUFFERPROC UnmapBuffer;
+	PFNGLDELETEBUFFERSPROC DeleteBuffers;
+
+} GL;
+
+/**
+ * Print usage information to stderr and exit with EXIT_FAILURE
+ */
+static void offscreenUsage(const char *program);
+
+/**
+ * Print an error to stderr and exit with EXIT_FAILURE
+ */
+static void offscreenError(const char *message);
+
+/**
+ * Get the current value of the monotonic clock in seconds
+ */
+static double offscreenTime();
+
+/**
+ * Create a GL context drawing into an offscreen pbuffer and make it current,
+ * returning false if EGL has no way to
+ */
+static bool offscreenCreateContext(int width, int height);
+
+/**
+ * Get a GL entry point from EGL
+ */
+static void *offscreenProcAddress(const char *name);
+
+/**
+ * Load the pixel buffer object entry points, returning false if any is missing
+ */
+static bool offscreenLoadReadback();
+
+/**
+ * Loop tick callback making the computer player's inputs
+ */
+static void offscreenTick(BlocksLoop *loop, void *data);
+
+/**
+ * Draw a snapshot into the framebuffer, with the sub-windows of the GLUT frontend
+ */
+static void offscreenDraw(BlocksView *game_view, BlocksView *next_piece_view, const BlocksSnapshot *snapshot, double now);
+
+/**
+ * Wait for a free frame in the writer's queue and get its pixels
+ */
+static unsigned char *offscreenTakeFrame(OffscreenWriter *writer);
+
+/**
+ * Hand the frame taken from the writer's queue to the writer thread
+ */
+static void offscreenSubmitFrame(OffscreenWriter *writer);
+
+/**
+ * Writer thread entry point, writes frames until the queue is empty and done
+ */
+static void *offscreenWriter(void *data);
+
+/**
+ * Write a frame as a binary PPM, returning the number of bytes written
+ */
+static long offscreenWritePPM(FILE *file, const unsigned char *pixels);
+
+/**
+ * Write a frame as a PNG compressed with stored deflate blocks, which needs no
+ * zlib and costs no time to compress, returning the number of bytes written
+ */
+static long offscreenWritePNG(OffscreenWriter *writer, FILE *file, const unsigned char *pixels);
+
+/**
+ * Write a PNG chunk, returning the number of bytes written
+ */
+static long offscreenWriteChunk(FILE *file, const char *type, const unsigned char *data, uint32_t length);
+
+/**
+ * Update a CRC-32 (as used by PNG) with a block of data
+ */
+static uint32_t offscreenCrc(uint32_t crc, const unsigned char *data, size_t length);
+
+/**
+ * Store a 32 bit value big endian
+ */
+static inline void offscreenPut32(unsigned char *data, uint32_t value)
+{
+	data[0] = value >> 24;
+	data[1] = value >> 16;
+	data[2] = value >> 8;
+	data[3] = value;
+}
+
+int main(int argc, char *argv[])
+{
+	int i, option;
+
+	long num_frames = 600;
+	int frame_rate = 60;
+	int difficulty = 0;
+	int beam_width = 8;
+	uint64_t seed = time(NULL);
+	bool immediate = false;
+
+	OffscreenWriter writer = {
+		.directory = ".",
+		.format = FORMAT_PPM
+	};
+
+	while((option = getopt(argc, argv, "f:r:o:t:d:a:S:i")) != -1)
+	{
+		switch(option)
+		{
+			case 'f':
+				num_frames = atol(optarg);
+				break;
+			case 'r':
+				frame_rate = atoi(optarg);
+				break;
+			case 'o':
+				writer.directory = optarg;
+				break;
+			case 't':
+				if(!strcmp(optarg, "ppm"))
+					writer.format = FORMAT_PPM;
+				else if(!strcmp(optarg, "png"))
+					writer.format = FORMAT_PNG;
+				else if(!strcmp(optarg, "none"))
+					writer.format = FORMAT_NONE;
+				else
+					offscreenUsage(argv[0]);
+				break;
+			case 'd':
+				difficulty = atoi(optarg);
+				break;
+			case 'a':
+				beam_width = atoi(optarg);
+				break;
+			case 'S':
+				seed = strtoull(optarg, NULL, 0);
+				break;
+			case 'i':
+				immediate = true;
+				break;
+			default:
+				offscreenUsage(argv[0]);
+		}
+	}
+
+	if(num_frames <= 0 || frame_rate <= 0 || difficulty < 0 || difficulty > 3 || beam_width <= 0)
+		offscreenUsage(argv[0]);
+
+	if(!offscreenCreateContext(OFFSCREEN_WIDTH, OFFSCREEN_HEIGHT))
+		offscreenError("Error creating an offscreen GL context.");
+
+	// the same GL state and views as the GLUT frontend's sub-windows
+
+	glClearColor(0.0, 0.0, 0.0, 1.0);
+	glEnable(GL_CULL_FACE);
+	glCullFace(GL_BACK);
+	glEnable(GL_DEPTH_TEST);
+	glDepthFunc(GL_LEQUAL);
+
+	bool instancing = !immediate && blocksLoadInstancing(offscreenProcAddress);
+
+	BlocksView *game_view = blocksNewView(instancing ? blocksNewInstanceRenderer(10 * (20 + BLOCKS_BUFFER_HEIGHT)) : NULL);
+	BlocksView *next_piece_view = blocksNewView(instancing ? blocksNewInstanceRenderer(BLOCKS_PIECE_SIZE * BLOCKS_PIECE_SIZE) : NULL);
+
+	game_view->rotation_delta[0] = difficulty & 2 ? 1.0 : 0.0;
+	game_view->rotation_delta[1] = difficulty & 1 ? 1.0 : 0.0;
+
+	// a game played by the computer player at the frontend's speed, on a clock
+	// of frame times rather than the wall clock so a run is reproducible
+
+	BlocksGame *game = blocksNewGameSeeded(BLOCKS_STANDARD_WIDTH, BLOCKS_STANDARD_HEIGHT, seed, RANDOMIZER_UNIFORM);
+	BlocksAI *ai = blocksNewAI(game->width, game->height - BLOCKS_BUFFER_HEIGHT, beam_width, 1);
+	BlocksLoop *loop = blocksNewLoop(game, BLOCKS_TICK_RATE, 0.0);
+	BlocksSnapshots *snapshots = blocksNewSnapshots(loop);
+
+	loop->gravity = loop->tick_length / 1000.0;
+	loop->on_tick = offscreenTick;
+	loop->data = ai;
+
+	// read each frame back into one of two pixel buffers, copying out the
+	// previous frame's while the current one is still being read
+
+	size_t frame_size = (size_t) OFFSCREEN_WIDTH * OFFSCREEN_HEIGHT * 3;
+	bool readback = offscreenLoadReadback();
+	GLuint pixel_buffers[2];
+
+	if(readback)
+	{
+		GL.GenBuffers(2, pixel_buffers);
+
+		for(i = 0; i < 2; i++)
+		{
+			GL.BindBuffer(GL_PIXEL_PACK_BUFFER, pixel_buffers[i]);
+			GL.BufferData(GL_PIXEL_PACK_BUFFER, frame_size, NULL, GL_STREAM_READ);
+		}
+
+		GL.BindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	}
+
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+
+	pthread_mutex_init(&writer.lock, NULL);
+	pthread_cond_init(&writer.filled, NULL);
+	pthread_cond_init(&writer.emptied, NULL);
+
+	for(i = 0; i < OFFSCREEN_QUEUE_SIZE; i++)
+	{
+		writer.frames[i].pixels = malloc(frame_size);
+
+		if(!writer.frames[i].pixels)
+			offscreenError("Error allocating memory for frames.");
+	}
+
+	writer.buffer = malloc(OFFSCREEN_HEIGHT * (3 * OFFSCREEN_WIDTH + 1) + OFFSCREEN_HEIGHT * 5 + 64);
+
+	if(!writer.buffer)
+		offscreenError("Error allocating memory for frames.");
+
+	if(pthread_create(&writer.thread, NULL, offscreenWriter, &writer))
+		offscreenError("Error creating the writer thread.");
+
+	double start = offscreenTime();
+	bool fresh;
+
+	for(long frame = 0; frame <= num_frames; frame++)
+	{
+		// copy out the frame read back last time round
+
+		if(readback && frame > 0)
+		{
+			GL.BindBuffer(GL_PIXEL_PACK_BUFFER, pixel_buffers[(frame - 1) % 2]);
+
+			const void *pixels = GL.MapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+
+			if(pixels)
+				memcpy(offscreenTakeFrame(&writer), pixels, frame_size);
+
+			GL.UnmapBuffer(GL_PIXEL_PACK_BUFFER);
+			GL.BindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+			if(pixels)
+				offscreenSubmitFrame(&writer);
+		}
+
+		if(frame == num_frames)
+			break;
+
+		double now = frame * 1000.0 / frame_rate;
+
+		blocksLoopAdvance(loop, now, BLOCKS_TICK_RATE);
+		blocksLoopPublish(loop, snapshots);
+
+		offscreenDraw(game_view, next_piece_view, blocksReadSnapshot(snapshots, &fresh), now);
+
+		if(readback)
+		{
+			GL.BindBuffer(GL_PIXEL_PACK_BUFFER, pixel_buffers[frame % 2]);
+			glReadPixels(0, 0, OFFSCREEN_WIDTH, OFFSCREEN_HEIGHT, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+			GL.BindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		}
+		else
+		{
+			glReadPixels(0, 0, OFFSCREEN_WIDTH, OFFSCREEN_HEIGHT, GL_RGB, GL_UNSIGNED_BYTE, offscreenTakeFrame(&writer));
+			offscreenSubmitFrame(&writer);
+		}
+	}
+
+	pthread_mutex_lock(&writer.lock);
+	writer.done = true;
+	pthread_cond_signal(&writer.filled);
+	pthread_mutex_unlock(&writer.lock);
+
+	pthread_join(writer.thread, NULL);
+
+	double elapsed = offscreenTime() - start;
+
+	const char *formats[] = {"none", "ppm", "png"};
+
+	printf("frames:     %ld\n", num_frames);
+	printf("size:       %dx%d\n", OFFSCREEN_WIDTH, OFFSCREEN_HEIGHT);
+	printf("renderer:   %s (%s)\n", (const char *) glGetString(GL_RENDERER), instancing ? "instanced" : "immediate");
+	printf("readback:   %s\n", readback ? "pixel buffers" : "synchronous");
+	printf("format:     %s\n", formats[writer.format]);
+	printf("seed:       %llu\n", (unsigned long long) seed);
+	printf("pieces:     %ld\n", game->pieces_placed);
+	printf("lines:      %ld\n", game->lines_cleared);
+	printf("time:       %.3f s\n", elapsed);
+	printf("frames/sec: %.1f\n", num_frames / elapsed);
+	printf("written:    %.1f MB\n", writer.bytes / 1e6);
+	printf("writer:     %.1f%% busy\n", 100.0 * writer.busy / elapsed);
+
+	if(readback)
+		GL.DeleteBuffers(2, pixel_buffers);
+
+	for(i = 0; i < OFFSCREEN_QUEUE_SIZE; i++)
+		free(writer.frames[i].pixels);
+
+	free(writer.buffer);
+
+	blocksFreeView(game_view);
+	blocksFreeView(next_piece_view);
+	blocksFreeSnapshots(snapshots);
+	blocksFreeLoop(loop);
+	blocksFreeAI(ai);
+	blocksFreeGame(game);
+
+	return EXIT_SUCCESS;
+}
+
+static void offscreenUsage(const char *program)
+{
+	fprintf(stderr, "Usage: %s [-f frames] [-r frame rate] [-o directory] [-t ppm|png|none] [-d difficulty] [-a beam width] [-S seed] [-i]\n", program);
+	fprintf(stderr, "Renders a game played by the computer player without a display, writing every frame to the directory.\n");
+	fprintf(stderr, "Difficulty 0 to 3 turns the camera as the easy to very hard games do, -i draws in immediate mode.\n");
+	exit(EXIT_FAILURE);
+}
+
+static void offscreenError(const char *message)
+{
+	fprintf(stderr, "BLOCKS3D: %s\n", message);
+	exit(EXIT_FAILURE);
+}
+
+static double offscreenTime()
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+static bool offscreenCreateContext(int width, int height)
+{
+	EGLint major, minor, num_configs;
+	EGLConfig config;
+	EGLDisplay display = EGL_NO_DISPLAY;
+
+	static const EGLint ConfigAttributes[] = {
+		EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_RED_SIZE, 8,
+		EGL_GREEN_SIZE, 8,
+		EGL_BLUE_SIZE, 8,
+		EGL_DEPTH_SIZE, 16,
+		EGL_NONE
+	};
+
+	// prefer Mesa's surfaceless platform, which needs no display server at all
+
+	const char *extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+	PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+		(PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+
+	if(extensions && strstr(extensions, "EGL_MESA_platform_surfaceless") && get_platform_display)
+		display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+
+	if(display == EGL_NO_DISPLAY)
+		display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+	if(display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor))
+		return false;
+
+	if(!eglChooseConfig(display, ConfigAttributes, &config, 1, &num_configs) || !num_configs)
+		return false;
+
+	if(!eglBindAPI(EGL_OPENGL_API))
+		return false;
+
+	EGLint surface_attributes[] = {EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE};
+
+	EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT, NULL);
+	EGLSurface surface = eglCreatePbufferSurface(display, config, surface_attributes);
+
+	if(context == EGL_NO_CONTEXT || surface == EGL_NO_SURFACE)
+		return false;
+
+	return eglMakeCurrent(display, surface, surface, context);
+}
+
+static void *offscreenProcAddress(const char *name)
+{
+	return (void *) eglGetProcAddress(name);
+}
+
+static bool offscreenLoadReadback()
+{
+	int major = 0, minor = 0;
+	const char *version = (const char *) glGetString(GL_VERSION);
+
+	if(!version || sscanf(version, "%d.%d", &major, &minor) != 2 || major * 10 + minor < 21)
+		return false;
+
+#define OFFSCREEN_LOAD(name) \
+	if(!(GL.name = offscreenProcAddress("gl" #name))) \
+		return false;
+
+	OFFSCREEN_LOAD(GenBuffers);
+	OFFSCREEN_LOAD(BindBuffer);
+	OFFSCREEN_LOAD(BufferData);
+	OFFSCREEN_LOAD(MapBuffer);
+	OFFSCREEN_LOAD(UnmapBuffer);
+	OFFSCREEN_LOAD(DeleteBuffers);
+
+#undef OFFSCREEN_LOAD
+
+	return true;
+}
+
+static void offscreenTick(BlocksLoop *loop, void *data)
+{
+	int i;
+	Input input;
+
+	for (i = 0; !loop->game->game_over && i < OFFSCREEN_AUTOPLAY_SPEED; i++)
+		if(blocksAINextInput(data, loop->game, &input))
+			blocksLoopApplyInput(loop, input);
+}
+
+static void offscreenDraw(BlocksView *game_view, BlocksView *next_piece_view, const BlocksSnapshot *snapshot, double now)
+{
+	// the sub-windows are placed from the top left of the main window
+
+	glViewport(0, 0, OFFSCREEN_WIDTH, OFFSCREEN_HEIGHT);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+	glViewport(10, OFFSCREEN_HEIGHT - 10 - 460, 460, 460);
+	blocksGameProjection();
+	blocksDrawGame(game_view, snapshot, now);
+
+	glViewport(495, OFFSCREEN_HEIGHT - 230 - 130, 130, 130);
+	blocksNextPieceProjection();
+	blocksDrawNextPiece(next_piece_view, snapshot->game);
+}
+
+static unsigned char *offscreenTakeFrame(OffscreenWriter *writer)
+{
+	pthread_mutex_lock(&writer->lock);
+
+	while(writer->tail - writer->head == OFFSCREEN_QUEUE_SIZE)
+		pthread_cond_wait(&writer->emptied, &writer->lock);
+
+	pthread_mutex_unlock(&writer->lock);
+
+	return writer->frames[writer->tail % OFFSCREEN_QUEUE_SIZE].pixels;
+}
+
+static void offscreenSubmitFrame(OffscreenWriter *writer)
+{
+	pthread_mutex_lock(&writer->lock);
+
+	writer->frames[writer->tail % OFFSCREEN_QUEUE_SIZE].number = writer->tail;
+	writer->tail++;
+
+	pthread_cond_signal(&writer->filled);
+	pthread_mutex_unlock(&writer->lock);
+}
+
+static void *offscreenWriter(void *data)
+{
+	char path[4096];
+	OffscreenWriter *writer = data;
+	const char *extensions[] = {"", "ppm", "png"};
+
+	pthread_mutex_lock(&writer->lock);
+
+	while(true)
+	{
+		while(writer->head == writer->tail && !writer->done)
+			pthread_cond_wait(&writer->filled, &writer->lock);
+
+		if(writer->head == writer->tail)
+			break;
+
+		OffscreenFrame *frame = &writer->frames[writer->head % OFFSCREEN_QUEUE_SIZE];
+
+		// encode without the lock so the render loop can queue the next frames
+
+		pthread_mutex_unlock(&writer->lock);
+
+		double start = offscreenTime();
+
+		if(writer->format != FORMAT_NONE)
+		{
+			snprintf(path, sizeof(path), "%s/frame%06ld.%s", writer->directory, frame->number, extensions[writer->format]);
+
+			FILE *file = fopen(path, "wb");
+
+			if(!file)
+				offscreenError("Error opening a frame file for writing.");
+
+			if(writer->format == FORMAT_PPM)
+				writer->bytes += offscreenWritePPM(file, frame->pixels);
+			else
+				writer->bytes += offscreenWritePNG(writer, file, frame->pixels);
+
+			if(fclose(file))
+				offscreenError("Error writing a frame file.");
+		}
+
+		writer->busy += offscreenTime() - start;
+
+		pthread_mutex_lock(&writer->lock);
+
+		writer->head++;
+		pthread_cond_signal(&writer->emptied);
+	}
+
+	pthread_mutex_unlock(&writer->lock);
+
+	return NULL;
+}
+
+static long offscreenWritePPM(FILE *file, const unsigned char *pixels)
+{
+	int y;
+	size_t stride = 3 * OFFSCREEN_WIDTH;
+	long bytes = fprintf(file, "P6\n%d %d\n255\n", OFFSCREEN_WIDTH, OFFSCREEN_HEIGHT);
+
+	// the framebuffer's rows are bottom up
+
+	for(y = OFFSCREEN_HEIGHT - 1; y >= 0; y--)
+		bytes += fwrite(pixels + y * stride, 1, stride, file);
+
+	return bytes;
+}
+
+static long offscreenWritePNG(OffscreenWriter *writer, FILE *file, const unsigned char *pixels)
+{
+	int y;
+	size_t i;
+	unsigned char header[13];
+	unsigned char *data = writer->buffer;
+	size_t stride = 3 * OFFSCREEN_WIDTH;
+	size_t raw_size = OFFSCREEN_HEIGHT * (stride + 1);
+	uint32_t a = 1, b = 0;
+
+	static const unsigned char Signature[8] = {137, 'P', 'N', 'G', '\r', '\n', 26, '\n'};
+
+	offscreenPut32(header, OFFSCREEN_WIDTH);
+	offscreenPut32(header + 4, OFFSCREEN_HEIGHT);
+	header[8] = 8;  // bits per channel
+	header[9] = 2;  // RGB
+	header[10] = 0;
+	header[11] = 0;
+	header[12] = 0;
+
+	// a zlib stream of stored blocks of at most 65535 bytes, each row top down
+	// and starting with filter type 0
+
+	size_t length = 0;
+
+	data[length++] = 0x78;
+	data[length++] = 0x01;
+
+	unsigned char *raw = data + length + 5 * ((raw_size + 65534) / 65535);
+
+	for(y = 0; y < OFFSCREEN_HEIGHT; y++)
+	{
+		raw[y * (stride + 1)] = 0;
+		memcpy(raw + y * (stride + 1) + 1, pixels + (OFFSCREEN_HEIGHT - 1 - y) * stride, stride);
+	}
+
+	for(i = 0; i < raw_size; i++)
+	{
+		a = (a + raw[i]) % 65521;
+		b = (b + a) % 65521;
+	}
+
+	for(i = 0; i < raw_size; i += 65535)
+	{
+		size_t block = raw_size - i < 65535 ? raw_size - i : 65535;
+
+		data[length++] = i + block == raw_size;
+		data[length++] = block;
+		data[length++] = block >> 8;
+		data[length++] = ~block;
+		data[length++] = ~block >> 8;
+
+		memmove(data + length, raw + i, block);
+		length += block;
+	}
+
+	offscreenPut32(data + length, b << 16 | a);
+	length += 4;
+
+	long bytes = fwrite(Signature, 1, sizeof(Signature), file);
+
+	bytes += offscreenWriteChunk(file, "IHDR", header, sizeof(header));
+	bytes += offscreenWriteChunk(file, "IDAT", data, length);
+	bytes += offscreenWriteChunk(file, "IEND", NULL, 0);
+
+	return bytes;
+}
+
+static long offscreenWriteChunk(FILE *file, const char *type, const unsigned char *data, uint32_t length)
+{
+	unsigned char field[4];
+	long bytes = 0;
+
+	offscreenPut32(field, length);
+	bytes += fwrite(field, 1, 4, file);
+	bytes += fwrite(type, 1, 4, file);
+
+	if(length)
+		bytes += fwrite(data, 1, length, file);
+
+	offscreenPut32(field, offscreenCrc(offscreenCrc(0, (const unsigned char *) type, 4), data, length));
+	bytes += fwrite(field, 1, 4, file);
+
+	return bytes;
+}
+
+static uint32_t offscreenCrc(uint32_t crc, const unsigned char *data, size_t length)
+{
+	int i;
+	size_t n;
+	static uint32_t Table[256];
+
+	if(!Table[1])
+	{
+		for(n = 0; n < 256; n++)
+		{
+			uint32_t c = n;
+
+			for(i = 0; i < 8; i++)
+				c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+
+			Table[n] = c;
+		}
+	}
+
+	crc = ~crc;
+
+	for(n = 0; n < length; n++)
+		crc = Table[(crc ^ data[n]) & 0xFF] ^ (crc >> 8);
+
+	return ~crc;
+}
@@ -0,0 +1,229 @@
+/**
+ * blocksplayer.c
+ *
+ * Headless Blocks replay player, re-simulating recorded games as fast as
+ * possible and checking they end as they were recorded
+ *
+ * @author Timothy Cheeseman
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "blocks.h"
+#include "blocksai.h"
+#include "blocksloop.h"
+#include "blocksreplay.h"
+
+/**
+ * The number of the computer player's inputs each tick, as in the GLUT frontend
+ */
+#define PLAYER_AUTOPLAY_SPEED 2
+
+/**
+ * Print usage information to stderr and exit with EXIT_FAILURE
+ */
+static void playerUsage(const char *program);
+
+/**
+ * Get the current value of the monotonic clock in seconds
+ */
+static double playerTime();
+
+/**
+ * Record a game played by the computer player through a loop, as the GLUT
+ * frontend plays it, returning false if the replay couldn't be written
+ */
+static bool playerRecord(const char *path, int difficulty, int beam_width, uint64_t seed, long max_ticks);
+
+/**
+ * Play a replay repeats times, printing its results, returning false if it is
+ * corrupt or didn't end as recorded
+ */
+static bool playerPlay(const char *path, int repeats);
+
+/**
+ * Loop tick callback making the computer player's inputs
+ */
+static void playerTick(BlocksLoop *loop, void *data);
+
+int main(int argc, char *argv[])
+{
+	int i, option;
+
+	const char *record = NULL;
+	int difficulty = 0;
+	int beam_width = 8;
+	uint64_t seed = time(NULL);
+	long max_ticks = 60L * 60 * 60;
+	int repeats = 1;
+	bool passed = true;
+
+	while((option = getopt(argc, argv, "r:d:a:S:m:n:")) != -1)
+	{
+		switch(option)
+		{
+			case 'r':
+				record = optarg;
+				break;
+			case 'd':
+				difficulty = atoi(optarg);
+				break;
+			case 'a':
+				beam_width = atoi(optarg);
+				break;
+			case 'S':
+				seed = strtoull(optarg, NULL, 0);
+				break;
+			case 'm':
+				max_ticks = atol(optarg);
+				break;
+			case 'n':
+				repeats = atoi(optarg);
+				break;
+			default:
+				playerUsage(argv[0]);
+		}
+	}
+
+	if(difficulty < 0 || difficulty > 3 || beam_width <= 0 || max_ticks <= 0 || repeats <= 0)
+		playerUsage(argv[0]);
+
+	if(!record && optind == argc)
+		playerUsage(argv[0]);
+
+	if(record && !playerRecord(record, difficulty, beam_width, seed, max_ticks))
+	{
+		fprintf(stderr, "BLOCKS3D: Error writing the replay to %s.\n", record);
+		return EXIT_FAILURE;
+	}
+
+	for(i = optind; i < argc; i++)
+	{
+		if(i > optind || record)
+			printf("\n");
+
+		passed &= playerPlay(argv[i], repeats);
+	}
+
+	return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static void playerUsage(const char *program)
+{
+	fprintf(stderr, "Usage: %s [-n repeats] replay...\n", program);
+	fprintf(stderr, "       %s -r replay [-d difficulty] [-a beam width] [-S seed] [-m max ticks] [replay...]\n", program);
+	fprintf(stderr, "Plays replays as fast as possible and checks their score and board, failing if any differ.\n");
+	fprintf(stderr, "With -r a game played by the computer player on difficulty 0 to 3 is recorded first.\n");
+	exit(EXIT_FAILURE);
+}
+
+static double playerTime()
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+static bool playerRecord(const char *path, int difficulty, int beam_width, uint64_t seed, long max_ticks)
+{
+	BlocksGame *game = blocksNewGameSeeded(BLOCKS_STANDARD_WIDTH, BLOCKS_STANDARD_HEIGHT, seed, RANDOMIZER_UNIFORM);
+	BlocksAI *ai = blocksNewAI(game->width, game->height - BLOCKS_BUFFER_HEIGHT, beam_width, 1);
+	BlocksLoop *loop = blocksNewLoop(game, BLOCKS_TICK_RATE, 0.0);
+
+	// the difficulty only changes the score multiplier and the camera
+
+	game->score_multiplier = difficulty + 1;
+
+	loop->gravity = loop->tick_length / 1000.0;
+	loop->on_tick = playerTick;
+	loop->data = ai;
+	loop->recorder = blocksNewRecorder(game, seed, BLOCKS_TICK_RATE);
+
+	while(!game->game_over && loop->tick < max_ticks)
+		blocksLoopAdvance(loop, blocksLoopNextTick(loop), 1);
+
+	bool saved = blocksSaveReplay(loop->recorder, game, path);
+
+	printf("recorded:   %s\n", path);
+	printf("seed:       %llu\n", (unsigned long long) seed);
+	printf("calls:      %llu\n", (unsigned long long) loop->recorder->num_calls);
+	printf("ticks:      %ld\n", loop->recorder->tick);
+	printf("score:      %ld\n", game->score);
+
+	blocksFreeRecorder(loop->recorder);
+	blocksFreeLoop(loop);
+	blocksFreeAI(ai);
+	blocksFreeGame(game);
+
+	return saved;
+}
+
+static bool playerPlay(const char *path, int repeats)
+{
+	int i;
+	BlocksGame *game = NULL;
+
+	BlocksReplay *replay = blocksOpenReplay(path);
+
+	if(!replay)
+	{
+		fprintf(stderr, "BLOCKS3D: %s is not a replay.\n", path);
+		return false;
+	}
+
+	double start = playerTime();
+
+	for(i = 0; i < repeats; i++)
+	{
+		if(game)
+			blocksFreeGame(game);
+
+		game = blocksPlayReplay(replay);
+
+		if(!game)
+		{
+			fprintf(stderr, "BLOCKS3D: %s is corrupt.\n", path);
+			blocksCloseReplay(replay);
+			return false;
+		}
+	}
+
+	double elapsed = playerTime() - start;
+	bool verified = blocksVerifyReplay(replay, game);
+	size_t bytes = replay->calls_end - replay->calls;
+
+	printf("replay:     %s\n", path);
+	printf("board:      %dx%d\n", replay->width, replay->height);
+	printf("seed:       %llu\n", (unsigned long long) replay->seed);
+	printf("calls:      %llu (%.2f bytes/call)\n", (unsigned long long) replay->num_calls,
+	       replay->num_calls ? (double) bytes / replay->num_calls : 0.0);
+	printf("ticks:      %ld (%.1f s)\n", replay->ticks, (double) replay->ticks / replay->tick_rate);
+	printf("score:      %ld (recorded %ld)\n", game->score, replay->score);
+	printf("pieces:     %ld\n", game->pieces_placed);
+	printf("lines:      %ld\n", game->lines_cleared);
+	printf("hash:       %016llx (recorded %016llx)\n", (unsigned long long) blocksBoardHash(game),
+	       (unsigned long long) replay->hash);
+	printf("result:     %s\n", verified ? "ok" : "MISMATCH");
+	printf("time:       %.6f s\n", elapsed / repeats);
+	printf("calls/sec:  %.0f\n", replay->num_calls * repeats / elapsed);
+
+	blocksFreeGame(game);
+	blocksCloseReplay(replay);
+
+	return verified;
+}
+
+static void playerTick(BlocksLoop *loop, void *data)
+{
+	int i;
+	Input input;
+
+	for (i = 0; !loop->game->game_over && i < PLAYER_AUTOPLAY_SPEED; i++)
+		if(blocksAINextInput(data, loop->game, &input))
+			blocksLoopApplyInput(loop, input);
+}
@@ -0,0 +1,168 @@
+/**
+ * blocksprofile.c
+ *
+ * Frame and engine timing for Blocks games, compiled in with BLOCKS_PROFILE
+ *
+ * @author Timothy Cheeseman
+ */
+
+#include "blocksprofile.h"
+
+#ifdef BLOCKS_PROFILE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+BlocksTimer BlocksTimers[PROFILE_NUM_TIMERS];
+
+/**
+ * The names of the timers
+ */
+static const char *ProfileNames[PROFILE_NUM_TIMERS] = {
+
+	"main_window",
+	"game_window",
+	"next_piece_window",
+	"tick",
+	"input",
+	"gravity",
+	"ai",
+	"publish"
+
+};
+
+/**
+ * Copy a timer's latest samples, returning how many there are
+ */
+static int profileSamples(ProfileTimer timer, uint32_t *samples);
+
+/**
+ * Compare samples for sorting
+ */
+static int profileCompare(const void *a, const void *b);
+
+uint64_t blocksProfileNow()
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+void blocksProfileRecord(ProfileTimer timer, uint64_t start)
+{
+	BlocksTimer *profile = &BlocksTimers[timer];
+	uint64_t elapsed = blocksProfileNow() - start;
+	uint64_t count = atomic_load_explicit(&profile->count, memory_order_relaxed);
+
+	// only the recording thread writes, so relaxed stores are all it needs and
+	// readers see at worst a sample from one lap of the ring earlier
+
+	atomic_store_explicit(&profile->samples[count % BLOCKS_PROFILE_SAMPLES],
+	                      elapsed < UINT32_MAX ? elapsed : UINT32_MAX, memory_order_relaxed);
+	atomic_store_explicit(&profile->count, count + 1, memory_order_release);
+}
+
+const char *blocksProfileName(ProfileTimer timer)
+{
+	return ProfileNames[timer];
+}
+
+void blocksProfileStats(ProfileTimer timer, BlocksTimerStats *stats)
+{
+	int i;
+	uint32_t samples[BLOCKS_PROFILE_SAMPLES];
+	int num_samples = profileSamples(timer, samples);
+	double total = 0.0;
+
+	stats->count = atomic_load_explicit(&BlocksTimers[timer].count, memory_order_acquire);
+	stats->mean = stats->p50 = stats->p99 = stats->max = 0.0;
+
+	if(!num_samples)
+		return;
+
+	qsort(samples, num_samples, sizeof(uint32_t), profileCompare);
+
+	for(i = 0; i < num_samples; i++)
+		total += samples[i];
+
+	stats->mean = total / num_samples * 1e-6;
+	stats->p50 = samples[(num_samples - 1) / 2] * 1e-6;
+	stats->p99 = samples[(num_samples - 1) * 99 / 100] * 1e-6;
+	stats->max = samples[num_samples - 1] * 1e-6;
+}
+
+bool blocksProfileDump(const char *path)
+{
+	int i, j;
+	size_t length = strlen(path);
+	bool json = length >= 5 && !strcmp(path + length - 5, ".json");
+	uint32_t samples[BLOCKS_PROFILE_SAMPLES];
+	BlocksTimerStats stats;
+
+	FILE *file = fopen(path, "w");
+
+	if(!file)
+		return false;
+
+	if(json)
+		fprintf(file, "{\n");
+	else
+		fprintf(file, "timer,count,mean_ms,p50_ms,p99_ms,max_ms\n");
+
+	for(i = 0; i < PROFILE_NUM_TIMERS; i++)
+	{
+		blocksProfileStats(i, &stats);
+
+		if(!json)
+		{
+			fprintf(file, "%s,%llu,%.6f,%.6f,%.6f,%.6f\n", ProfileNames[i], (unsigned long long) stats.count,
+			        stats.mean, stats.p50, stats.p99, stats.max);
+			continue;
+		}
+
+		fprintf(file, "\t\"%s\": {\"count\": %llu, \"mean_ms\": %.6f, \"p50_ms\": %.6f, \"p99_ms\": %.6f, \"max_ms\": %.6f, \"samples_ms\": [",
+		        ProfileNames[i], (unsigned long long) stats.count, stats.mean, stats.p50, stats.p99, stats.max);
+
+		// the samples oldest first
+
+		int num_samples = profileSamples(i, samples);
+
+		for(j = 0; j < num_samples; j++)
+			fprintf(file, "%s%.6f", j ? ", " : "", samples[j] * 1e-6);
+
+		fprintf(file, "]}%s\n", i + 1 < PROFILE_NUM_TIMERS ? "," : "");
+	}
+
+	if(json)
+		fprintf(file, "}\n");
+
+	return !fclose(file);
+}
+
+static int profileSamples(ProfileTimer timer, uint32_t *samples)
+{
+	int i;
+	BlocksTimer *profile = &BlocksTimers[timer];
+	uint64_t count = atomic_load_explicit(&profile->count, memory_order_acquire);
+	int num_samples = count < BLOCKS_PROFILE_SAMPLES ? count : BLOCKS_PROFILE_SAMPLES;
+
+	for(i = 0; i < num_samples; i++)
+		samples[i] = atomic_load_explicit(&profile->samples[(count - num_samples + i) % BLOCKS_PROFILE_SAMPLES],
+		                                  memory_order_relaxed);
+
+	return num_samples;
+}
+
+static int profileCompare(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *) a;
+	uint32_t y = *(const uint32_t *) b;
+
+	return (x > y) - (x < y);
+}
+
+#endif /* BLOCKS_PROFILE */
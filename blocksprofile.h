@@ -0,0 +1,108 @@
+/**
+ * blocksprofile.h
+ *
+ * Frame and engine timing for Blocks games, compiled in with BLOCKS_PROFILE
+ *
+ * @author Timothy Cheeseman
+ */
+
+#ifndef _BLOCKSPROFILE_H
+#define _BLOCKSPROFILE_H
+
+#ifdef BLOCKS_PROFILE
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * The number of latest samples each timer keeps its statistics over
+ */
+#define BLOCKS_PROFILE_SAMPLES 1024
+
+/**
+ * What is timed
+ */
+typedef enum ProfileTimer {
+
+	PROFILE_MAIN_WINDOW,
+	PROFILE_GAME_WINDOW,
+	PROFILE_NEXT_PIECE_WINDOW,
+	PROFILE_TICK,
+	PROFILE_INPUT,
+	PROFILE_GRAVITY,
+	PROFILE_AI,
+	PROFILE_PUBLISH,
+	PROFILE_NUM_TIMERS
+
+} ProfileTimer;
+
+/**
+ * Ring buffer of the latest durations of something in ns, written by one
+ * thread at a time and readable from any other
+ */
+typedef struct BlocksTimer {
+
+	_Alignas(64) _Atomic uint64_t count;
+	_Atomic uint32_t samples[BLOCKS_PROFILE_SAMPLES];
+
+} BlocksTimer;
+
+/**
+ * Statistics of a timer's latest samples in ms, and its total number of samples
+ */
+typedef struct BlocksTimerStats {
+
+	uint64_t count;
+	double mean;
+	double p50;
+	double p99;
+	double max;
+
+} BlocksTimerStats;
+
+/**
+ * Every timer
+ */
+extern BlocksTimer BlocksTimers[PROFILE_NUM_TIMERS];
+
+/**
+ * Get the current value of the monotonic clock in ns
+ */
+uint64_t blocksProfileNow();
+
+/**
+ * Record the time since start (from blocksProfileNow) in a timer
+ */
+void blocksProfileRecord(ProfileTimer timer, uint64_t start);
+
+/**
+ * Get the name of a timer
+ */
+const char *blocksProfileName(ProfileTimer timer);
+
+/**
+ * Get the statistics of a timer's latest samples
+ */
+void blocksProfileStats(ProfileTimer timer, BlocksTimerStats *stats);
+
+/**
+ * Write every timer's statistics to a file, as JSON with the samples if its
+ * name ends in .json and as CSV otherwise, returning false on failure
+ */
+bool blocksProfileDump(const char *path);
+
+/**
+ * Time the rest of a block under a timer, ending at BLOCKS_PROFILE_END
+ */
+#define BLOCKS_PROFILE_BEGIN(timer) uint64_t profile_start_##timer = blocksProfileNow()
+#define BLOCKS_PROFILE_END(timer) blocksProfileRecord(timer, profile_start_##timer)
+
+#else
+
+#define BLOCKS_PROFILE_BEGIN(timer) ((void) 0)
+#define BLOCKS_PROFILE_END(timer) ((void) 0)
+
+#endif /* BLOCKS_PROFILE */
+
+#endif /* _BLOCKSPROFILE_H */
@@ -0,0 +1,306 @@
+/**
+ * blocksrender.c
+ *
+ * Instanced OpenGL block rendering for Blocks games
+ *
+ * @author Timothy Cheeseman
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "blocksrender.h"
+
+#ifdef __APPLE__
+#include <OpenGL/glext.h>
+#else
+#include <GL/glext.h>
+#endif
+
+/**
+ * The GL entry points beyond GL 1.1, loaded at run time
+ */
+static struct {
+
+	PFNGLCREATESHADERPROC CreateShader;
+	PFNGLSHADERSOURCEPROC ShaderSource;
+	PFNGLCOMPILESHADERPROC CompileShader;
+	PFNGLGETSHADERIVPROC GetShaderiv;
+	PFNGLDELETESHADERPROC DeleteShader;
+	PFNGLCREATEPROGRAMPROC CreateProgram;
+	PFNGLATTACHSHADERPROC AttachShader;
+	PFNGLBINDATTRIBLOCATIONPROC BindAttribLocation;
+	PFNGLLINKPROGRAMPROC LinkProgram;
+	PFNGLGETPROGRAMIVPROC GetProgramiv;
+	PFNGLUSEPROGRAMPROC UseProgram;
+	PFNGLDELETEPROGRAMPROC DeleteProgram;
+	PFNGLGENBUFFERSPROC GenBuffers;
+	PFNGLBINDBUFFERPROC BindBuffer;
+	PFNGLBUFFERDATAPROC BufferData;
+	PFNGLBUFFERSUBDATAPROC BufferSubData;
+	PFNGLDELETEBUFFERSPROC DeleteBuffers;
+	PFNGLVERTEXATTRIBPOINTERPROC VertexAttribPointer;
+	PFNGLENABLEVERTEXATTRIBARRAYPROC EnableVertexAttribArray;
+	PFNGLDISABLEVERTEXATTRIBARRAYPROC DisableVertexAttribArray;
+	PFNGLVERTEXATTRIBDIVISORPROC VertexAttribDivisor;
+	PFNGLDRAWARRAYSINSTANCEDPROC DrawArraysInstanced;
+
+} GL;
+
+/**
+ * The vertex attribute locations, the cube corner being attribute 0 so it
+ * stands in for glVertex in compatibility contexts
+ */
+enum {
+
+	ATTRIBUTE_CORNER,
+	ATTRIBUTE_OFFSET,
+	ATTRIBUTE_COLOR
+
+};
+
+/**
+ * Vertex shader, placing a unit cube at each instance with the fixed function
+ * matrices so the frontend's camera applies unchanged
+ */
+static const char *VertexShader =
+	"#version 120\n"
+	"attribute vec3 corner;\n"
+	"attribute vec4 offset;\n"
+	"attribute vec3 color;\n"
+	"varying vec3 local;\n"
+	"varying vec3 tint;\n"
+	"void main()\n"
+	"{\n"
+	"	local = corner;\n"
+	"	tint = color;\n"
+	"	gl_Position = gl_ModelViewProjectionMatrix * vec4(offset.xyz + corner * offset.w, 1.0);\n"
+	"}\n";
+
+/**
+ * Fragment shader, drawing the edges of each cube in black in place of a wire cube
+ */
+static const char *FragmentShader =
+	"#version 120\n"
+	"varying vec3 local;\n"
+	"varying vec3 tint;\n"
+	"void main()\n"
+	"{\n"
+	"	vec3 edge = step(vec3(0.47), abs(local));\n"
+	"	gl_FragColor = vec4(edge.x + edge.y + edge.z >= 2.0 ? vec3(0.0) : tint, 1.0);\n"
+	"}\n";
+
+/**
+ * Print an error to stderr and exit with EXIT_FAILURE
+ */
+static void renderError(const char *message);
+
+/**
+ * Compile a shader, returning 0 on failure
+ */
+static GLuint renderCompileShader(GLenum type, const char *source);
+
+static void renderError(const char *message)
+{
+	fprintf(stderr, "BLOCKS3D: %s\n", message);
+	exit(EXIT_FAILURE);
+}
+
+bool blocksLoadInstancing(void *(*get_proc_address)(const char *name))
+{
+	int major = 0, minor = 0;
+	const char *version = (const char *) glGetString(GL_VERSION);
+
+	if(!version || sscanf(version, "%d.%d", &major, &minor) != 2 || major * 10 + minor < 33)
+		return false;
+
+#define RENDER_LOAD(name) \
+	if(!(GL.name = (void *) get_proc_address("gl" #name))) \
+		return false;
+
+	RENDER_LOAD(CreateShader);
+	RENDER_LOAD(ShaderSource);
+	RENDER_LOAD(CompileShader);
+	RENDER_LOAD(GetShaderiv);
+	RENDER_LOAD(DeleteShader);
+	RENDER_LOAD(CreateProgram);
+	RENDER_LOAD(AttachShader);
+	RENDER_LOAD(BindAttribLocation);
+	RENDER_LOAD(LinkProgram);
+	RENDER_LOAD(GetProgramiv);
+	RENDER_LOAD(UseProgram);
+	RENDER_LOAD(DeleteProgram);
+	RENDER_LOAD(GenBuffers);
+	RENDER_LOAD(BindBuffer);
+	RENDER_LOAD(BufferData);
+	RENDER_LOAD(BufferSubData);
+	RENDER_LOAD(DeleteBuffers);
+	RENDER_LOAD(VertexAttribPointer);
+	RENDER_LOAD(EnableVertexAttribArray);
+	RENDER_LOAD(DisableVertexAttribArray);
+	RENDER_LOAD(VertexAttribDivisor);
+	RENDER_LOAD(DrawArraysInstanced);
+
+#undef RENDER_LOAD
+
+	return true;
+}
+
+InstanceRenderer *blocksNewInstanceRenderer(int capacity)
+{
+	int face, corner;
+	GLint linked;
+	GLfloat cube[36][3];
+
+	static const int Corners[6][2] = {{0, 0}, {1, 0}, {1, 1}, {0, 0}, {1, 1}, {0, 1}};
+
+	GLuint vertex = renderCompileShader(GL_VERTEX_SHADER, VertexShader);
+	GLuint fragment = renderCompileShader(GL_FRAGMENT_SHADER, FragmentShader);
+
+	if(!vertex || !fragment)
+		return NULL;
+
+	GLuint program = GL.CreateProgram();
+
+	GL.AttachShader(program, vertex);
+	GL.AttachShader(program, fragment);
+	GL.BindAttribLocation(program, ATTRIBUTE_CORNER, "corner");
+	GL.BindAttribLocation(program, ATTRIBUTE_OFFSET, "offset");
+	GL.BindAttribLocation(program, ATTRIBUTE_COLOR, "color");
+	GL.LinkProgram(program);
+	GL.DeleteShader(vertex);
+	GL.DeleteShader(fragment);
+	GL.GetProgramiv(program, GL_LINK_STATUS, &linked);
+
+	if(!linked)
+	{
+		GL.DeleteProgram(program);
+		return NULL;
+	}
+
+	InstanceRenderer *renderer = malloc(sizeof(InstanceRenderer));
+
+	if(!renderer)
+		renderError("Error allocating memory for an instanced renderer.");
+
+	renderer->program = program;
+	renderer->capacity = capacity;
+	renderer->num_instances = 0;
+	renderer->instances = malloc(capacity * sizeof(BlockInstance));
+
+	if(!renderer->instances)
+		renderError("Error allocating memory for an instanced renderer.");
+
+	// two counter clockwise triangles for each face of a unit cube, the face
+	// along axis a spanned by the next two axes in the order that faces out
+
+	for(face = 0; face < 6; face++)
+	{
+		int axis = face / 2;
+		int sign = face % 2 ? -1 : 1;
+		int u = sign > 0 ? (axis + 1) % 3 : (axis + 2) % 3;
+		int v = sign > 0 ? (axis + 2) % 3 : (axis + 1) % 3;
+
+		for(corner = 0; corner < 6; corner++)
+		{
+			GLfloat *position = cube[face * 6 + corner];
+
+			position[axis] = 0.5 * sign;
+			position[u] = Corners[corner][0] - 0.5;
+			position[v] = Corners[corner][1] - 0.5;
+		}
+	}
+
+	GL.GenBuffers(1, &renderer->cube_buffer);
+	GL.BindBuffer(GL_ARRAY_BUFFER, renderer->cube_buffer);
+	GL.BufferData(GL_ARRAY_BUFFER, sizeof(cube), cube, GL_STATIC_DRAW);
+
+	GL.GenBuffers(1, &renderer->instance_buffer);
+	GL.BindBuffer(GL_ARRAY_BUFFER, renderer->instance_buffer);
+	GL.BufferData(GL_ARRAY_BUFFER, capacity * sizeof(BlockInstance), NULL, GL_STREAM_DRAW);
+	GL.BindBuffer(GL_ARRAY_BUFFER, 0);
+
+	return renderer;
+}
+
+void blocksAddInstance(InstanceRenderer *renderer, GLfloat x, GLfloat y, GLfloat z, GLfloat size, Color color)
+{
+	if(renderer->num_instances == renderer->capacity)
+		return;
+
+	BlockInstance *instance = &renderer->instances[renderer->num_instances++];
+
+	instance->position[0] = x;
+	instance->position[1] = y;
+	instance->position[2] = z;
+	instance->size = size;
+	instance->color[0] = color.r;
+	instance->color[1] = color.g;
+	instance->color[2] = color.b;
+	instance->color[3] = 255;
+}
+
+void blocksDrawInstances(InstanceRenderer *renderer)
+{
+	if(!renderer->num_instances)
+		return;
+
+	GL.UseProgram(renderer->program);
+
+	GL.BindBuffer(GL_ARRAY_BUFFER, renderer->cube_buffer);
+	GL.VertexAttribPointer(ATTRIBUTE_CORNER, 3, GL_FLOAT, GL_FALSE, 0, NULL);
+	GL.EnableVertexAttribArray(ATTRIBUTE_CORNER);
+
+	// every instance is uploaded each frame, which is a few kilobytes at most
+
+	GL.BindBuffer(GL_ARRAY_BUFFER, renderer->instance_buffer);
+	GL.BufferSubData(GL_ARRAY_BUFFER, 0, renderer->num_instances * sizeof(BlockInstance), renderer->instances);
+	GL.VertexAttribPointer(ATTRIBUTE_OFFSET, 4, GL_FLOAT, GL_FALSE, sizeof(BlockInstance),
+	                       (void *) offsetof(BlockInstance, position));
+	GL.VertexAttribPointer(ATTRIBUTE_COLOR, 3, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(BlockInstance),
+	                       (void *) offsetof(BlockInstance, color));
+	GL.EnableVertexAttribArray(ATTRIBUTE_OFFSET);
+	GL.EnableVertexAttribArray(ATTRIBUTE_COLOR);
+	GL.VertexAttribDivisor(ATTRIBUTE_OFFSET, 1);
+	GL.VertexAttribDivisor(ATTRIBUTE_COLOR, 1);
+
+	GL.DrawArraysInstanced(GL_TRIANGLES, 0, 36, renderer->num_instances);
+
+	GL.VertexAttribDivisor(ATTRIBUTE_OFFSET, 0);
+	GL.VertexAttribDivisor(ATTRIBUTE_COLOR, 0);
+	GL.DisableVertexAttribArray(ATTRIBUTE_CORNER);
+	GL.DisableVertexAttribArray(ATTRIBUTE_OFFSET);
+	GL.DisableVertexAttribArray(ATTRIBUTE_COLOR);
+	GL.BindBuffer(GL_ARRAY_BUFFER, 0);
+
+	GL.UseProgram(0);
+}
+
+static GLuint renderCompileShader(GLenum type, const char *source)
+{
+	GLint compiled;
+	GLuint shader = GL.CreateShader(type);
+
+	GL.ShaderSource(shader, 1, &source, NULL);
+	GL.CompileShader(shader);
+	GL.GetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+
+	if(!compiled)
+	{
+		GL.DeleteShader(shader);
+		return 0;
+	}
+
+	return shader;
+}
+
+void blocksFreeInstanceRenderer(InstanceRenderer *renderer)
+{
+	GL.DeleteBuffers(1, &renderer->cube_buffer);
+	GL.DeleteBuffers(1, &renderer->instance_buffer);
+	GL.DeleteProgram(renderer->program);
+
+	free(renderer->instances);
+	free(renderer);
+}
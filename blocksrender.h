@@ -0,0 +1,81 @@
+/**
+ * blocksrender.h
+ *
+ * Instanced OpenGL block rendering for Blocks games
+ *
+ * @author Timothy Cheeseman
+ */
+
+#ifndef _BLOCKSRENDER_H
+#define _BLOCKSRENDER_H
+
+#include <stdbool.h>
+
+#ifdef __APPLE__
+#include <OpenGL/gl.h>
+#else
+#include <GL/gl.h>
+#endif
+
+#include "blocks.h"
+
+/**
+ * Per block instance data, the center and size of a cube and its color
+ */
+typedef struct BlockInstance {
+
+	GLfloat position[3];
+	GLfloat size;
+	GLubyte color[4];
+
+} BlockInstance;
+
+/**
+ * Renderer drawing every block added to it with a single instanced draw call,
+ * the buffers and shader program belonging to the GL context it was created in
+ */
+typedef struct InstanceRenderer {
+
+	GLuint program;
+	GLuint cube_buffer;
+	GLuint instance_buffer;
+
+	int capacity;
+	int num_instances;
+	BlockInstance *instances;
+
+} InstanceRenderer;
+
+/**
+ * Load the GL 3.3 entry points used for instancing with a platform's
+ * GetProcAddress, from a current context
+ *
+ * Returns false if the context is older than GL 3.3 or an entry point is
+ * missing, in which case only immediate mode rendering is available.
+ */
+bool blocksLoadInstancing(void *(*get_proc_address)(const char *name));
+
+/**
+ * Create an instanced renderer for up to capacity blocks in the current context
+ *
+ * Returns NULL if the shaders fail to build.
+ */
+InstanceRenderer *blocksNewInstanceRenderer(int capacity);
+
+/**
+ * Add a block to be drawn
+ */
+void blocksAddInstance(InstanceRenderer *renderer, GLfloat x, GLfloat y, GLfloat z, GLfloat size, Color color);
+
+/**
+ * Draw every block added since the instance count was last reset, with a
+ * black outline along the edges of each block
+ */
+void blocksDrawInstances(InstanceRenderer *renderer);
+
+/**
+ * Free an instanced renderer, its context must be current
+ */
+void blocksFreeInstanceRenderer(InstanceRenderer *renderer);
+
+#endif /* _BLOCKSRENDER_H */
@@ -0,0 +1,364 @@
+/**
+ * blocksreplay.c
+ *
+ * Recording and playback of Blocks games for the Blocks library
+ *
+ * @author Timothy Cheeseman
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "blocksreplay.h"
+
+/**
+ * The bytes every replay starts with, followed by the format version
+ */
+static const uint8_t ReplayMagic[4] = {'B', 'L', 'K', 'R'};
+
+/**
+ * The size of the footer at the end of a replay: the number of calls, ticks,
+ * score, pieces placed, lines cleared and board hash as 64 bit little endian words
+ */
+#define REPLAY_FOOTER_SIZE (6 * 8)
+
+/**
+ * The bits of a call's varint holding the call, the rest holding the ticks since the last one
+ */
+#define REPLAY_CALL_BITS 3
+
+/**
+ * The tallest board a replay is accepted with
+ */
+#define REPLAY_MAX_HEIGHT 65536
+
+/**
+ * Print an error to stderr and exit with EXIT_FAILURE
+ */
+static void replayError(const char *message);
+
+/**
+ * Make room for bytes more bytes at the end of a recording
+ */
+static void replayReserve(BlocksRecorder *recorder, size_t bytes);
+
+/**
+ * Append an unsigned LEB128 varint to a recording
+ */
+static void replayPutVarint(BlocksRecorder *recorder, uint64_t value);
+
+/**
+ * Decode an unsigned LEB128 varint, returning false if it runs past the end
+ */
+static bool replayGetVarint(const uint8_t **data, const uint8_t *end, uint64_t *value);
+
+/**
+ * Write a 64 bit little endian word
+ */
+static void replayPutWord(uint8_t *data, uint64_t value);
+
+/**
+ * Read a 64 bit little endian word
+ */
+static uint64_t replayGetWord(const uint8_t *data);
+
+static void replayError(const char *message)
+{
+	fprintf(stderr, "BLOCKS3D: %s\n", message);
+	exit(EXIT_FAILURE);
+}
+
+BlocksRecorder *blocksNewRecorder(const BlocksGame *game, uint64_t seed, int tick_rate)
+{
+	BlocksRecorder *recorder = malloc(sizeof(BlocksRecorder));
+
+	if(!recorder)
+		replayError("Error allocating memory for a replay recorder.");
+
+	recorder->data = NULL;
+	recorder->size = 0;
+	recorder->capacity = 0;
+	recorder->tick = 0;
+	recorder->num_calls = 0;
+
+	// the header: the magic, the version, the game's size (without its buffer),
+	// randomizer and score multiplier and the tick rate as varints, and the
+	// seed as a word
+
+	replayReserve(recorder, sizeof(ReplayMagic) + 1);
+	memcpy(recorder->data, ReplayMagic, sizeof(ReplayMagic));
+	recorder->data[sizeof(ReplayMagic)] = BLOCKS_REPLAY_VERSION;
+	recorder->size = sizeof(ReplayMagic) + 1;
+
+	replayPutVarint(recorder, game->width);
+	replayPutVarint(recorder, game->height - BLOCKS_BUFFER_HEIGHT);
+	replayPutVarint(recorder, game->randomizer);
+	replayPutVarint(recorder, game->score_multiplier);
+	replayPutVarint(recorder, tick_rate);
+
+	replayReserve(recorder, 8);
+	replayPutWord(recorder->data + recorder->size, seed);
+	recorder->size += 8;
+
+	return recorder;
+}
+
+void blocksRecordCall(BlocksRecorder *recorder, long tick, ReplayCall call)
+{
+	replayPutVarint(recorder, (uint64_t) (tick - recorder->tick) << REPLAY_CALL_BITS | call);
+
+	recorder->tick = tick;
+	recorder->num_calls++;
+}
+
+bool blocksSaveReplay(const BlocksRecorder *recorder, const BlocksGame *game, const char *path)
+{
+	uint8_t footer[REPLAY_FOOTER_SIZE];
+
+	replayPutWord(footer, recorder->num_calls);
+	replayPutWord(footer + 8, recorder->tick);
+	replayPutWord(footer + 16, game->score);
+	replayPutWord(footer + 24, game->pieces_placed);
+	replayPutWord(footer + 32, game->lines_cleared);
+	replayPutWord(footer + 40, blocksBoardHash(game));
+
+	FILE *file = fopen(path, "wb");
+
+	if(!file)
+		return false;
+
+	bool written = fwrite(recorder->data, 1, recorder->size, file) == recorder->size &&
+	               fwrite(footer, 1, sizeof(footer), file) == sizeof(footer);
+
+	return !fclose(file) && written;
+}
+
+void blocksFreeRecorder(BlocksRecorder *recorder)
+{
+	free(recorder->data);
+	free(recorder);
+}
+
+BlocksReplay *blocksOpenReplay(const char *path)
+{
+	struct stat status;
+	uint64_t width, height, randomizer, score_multiplier, tick_rate;
+
+	int fd = open(path, O_RDONLY);
+
+	if(fd < 0)
+		return NULL;
+
+	if(fstat(fd, &status) || (size_t) status.st_size < sizeof(ReplayMagic) + 1 + REPLAY_FOOTER_SIZE)
+	{
+		close(fd);
+		return NULL;
+	}
+
+	void *data = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	close(fd);
+
+	if(data == MAP_FAILED)
+		return NULL;
+
+	BlocksReplay *replay = malloc(sizeof(BlocksReplay));
+
+	if(!replay)
+		replayError("Error allocating memory for a replay.");
+
+	replay->data = data;
+	replay->size = status.st_size;
+
+	// the calls run from the end of the header to the footer
+
+	const uint8_t *footer = replay->data + replay->size - REPLAY_FOOTER_SIZE;
+	const uint8_t *header = replay->data + sizeof(ReplayMagic) + 1;
+
+	if(memcmp(replay->data, ReplayMagic, sizeof(ReplayMagic)) || replay->data[sizeof(ReplayMagic)] != BLOCKS_REPLAY_VERSION ||
+	   !replayGetVarint(&header, footer, &width) || !replayGetVarint(&header, footer, &height) ||
+	   !replayGetVarint(&header, footer, &randomizer) || !replayGetVarint(&header, footer, &score_multiplier) ||
+	   !replayGetVarint(&header, footer, &tick_rate) || footer - header < 8 ||
+	   width < BLOCKS_PIECE_SIZE || width > (uint64_t) BLOCKS_MAX_WIDTH || !height ||
+	   height > REPLAY_MAX_HEIGHT || randomizer > RANDOMIZER_BAG || !tick_rate || tick_rate > INT32_MAX ||
+	   score_multiplier > INT32_MAX)
+	{
+		blocksCloseReplay(replay);
+		return NULL;
+	}
+
+	replay->width = width;
+	replay->height = height;
+	replay->randomizer = randomizer;
+	replay->score_multiplier = score_multiplier;
+	replay->tick_rate = tick_rate;
+	replay->seed = replayGetWord(header);
+
+	replay->calls = header + 8;
+	replay->calls_end = footer;
+
+	replay->num_calls = replayGetWord(footer);
+	replay->ticks = replayGetWord(footer + 8);
+	replay->score = replayGetWord(footer + 16);
+	replay->pieces_placed = replayGetWord(footer + 24);
+	replay->lines_cleared = replayGetWord(footer + 32);
+	replay->hash = replayGetWord(footer + 40);
+
+	return replay;
+}
+
+BlocksGame *blocksPlayReplay(const BlocksReplay *replay)
+{
+	uint64_t value;
+	uint64_t num_calls = 0;
+	uint64_t ticks = 0;
+	const uint8_t *calls = replay->calls;
+
+	BlocksGame *game = blocksNewGameSeeded(replay->width, replay->height, replay->seed, replay->randomizer);
+
+	game->score_multiplier = replay->score_multiplier;
+
+	// the ticks between calls only matter for watching a replay, the game is
+	// the same whenever each call is made
+
+	while(calls < replay->calls_end)
+	{
+		if(!replayGetVarint(&calls, replay->calls_end, &value) ||
+		   (value & ((1 << REPLAY_CALL_BITS) - 1)) >= REPLAY_NUM_CALLS)
+		{
+			blocksFreeGame(game);
+			return NULL;
+		}
+
+		ReplayCall call = value & ((1 << REPLAY_CALL_BITS) - 1);
+
+		num_calls++;
+		ticks += value >> REPLAY_CALL_BITS;
+
+		if(call == REPLAY_GRAVITY)
+			blocksMovePiece(game, DIRECTION_DOWN);
+		else
+			blocksApplyInput(game, (Input) call);
+	}
+
+	// a replay cut short can still decode, but not to the number of calls and
+	// ticks its footer says were recorded
+
+	if(num_calls != replay->num_calls || ticks != (uint64_t) replay->ticks)
+	{
+		blocksFreeGame(game);
+		return NULL;
+	}
+
+	return game;
+}
+
+bool blocksVerifyReplay(const BlocksReplay *replay, const BlocksGame *game)
+{
+	return game->score == replay->score && game->pieces_placed == replay->pieces_placed &&
+	       game->lines_cleared == replay->lines_cleared && blocksBoardHash(game) == replay->hash;
+}
+
+void blocksCloseReplay(BlocksReplay *replay)
+{
+	munmap((void *) replay->data, replay->size);
+	free(replay);
+}
+
+uint64_t blocksBoardHash(const BlocksGame *game)
+{
+	size_t i;
+	int j;
+	uint64_t hash = 0xcbf29ce484222325;
+
+	// hashed a byte at a time, lowest first, so the hash doesn't depend on byte order
+
+	for(i = 0; i < (size_t) game->height * game->row_words; i++)
+	{
+		for(j = 0; j < 8; j++)
+		{
+			hash ^= (uint8_t) (game->rows[i] >> (8 * j));
+			hash *= 0x100000001b3;
+		}
+	}
+
+	return hash;
+}
+
+static void replayReserve(BlocksRecorder *recorder, size_t bytes)
+{
+	if(recorder->size + bytes <= recorder->capacity)
+		return;
+
+	size_t capacity = recorder->capacity ? recorder->capacity : 4096;
+
+	while(capacity < recorder->size + bytes)
+		capacity *= 2;
+
+	uint8_t *data = realloc(recorder->data, capacity);
+
+	if(!data)
+		replayError("Error allocating memory for a replay.");
+
+	recorder->data = data;
+	recorder->capacity = capacity;
+}
+
+static void replayPutVarint(BlocksRecorder *recorder, uint64_t value)
+{
+	replayReserve(recorder, 10);
+
+	do
+	{
+		uint8_t byte = value & 0x7f;
+
+		value >>= 7;
+		recorder->data[recorder->size++] = byte | (value ? 0x80 : 0);
+	}
+	while(value);
+}
+
+static bool replayGetVarint(const uint8_t **data, const uint8_t *end, uint64_t *value)
+{
+	int shift;
+	const uint8_t *byte = *data;
+
+	*value = 0;
+
+	for(shift = 0; byte < end && shift < 64; shift += 7)
+	{
+		*value |= (uint64_t) (*byte & 0x7f) << shift;
+
+		if(!(*byte++ & 0x80))
+		{
+			*data = byte;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static void replayPutWord(uint8_t *data, uint64_t value)
+{
+	int i;
+
+	for(i = 0; i < 8; i++)
+		data[i] = value >> (8 * i);
+}
+
+static uint64_t replayGetWord(const uint8_t *data)
+{
+	int i;
+	uint64_t value = 0;
+
+	for(i = 0; i < 8; i++)
+		value |= (uint64_t) data[i] << (8 * i);
+
+	return value;
+}
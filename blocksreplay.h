@@ -0,0 +1,127 @@
+/**
+ * blocksreplay.h
+ *
+ * Recording and playback of Blocks games for the Blocks library
+ *
+ * @author Timothy Cheeseman
+ */
+
+#ifndef _BLOCKSREPLAY_H
+#define _BLOCKSREPLAY_H
+
+#include "blocks.h"
+
+/**
+ * The version of the replay format written
+ */
+#define BLOCKS_REPLAY_VERSION 1
+
+/**
+ * An engine call in a replay, either a player input or a row of gravity
+ */
+typedef enum ReplayCall {
+
+	REPLAY_LEFT = INPUT_LEFT,
+	REPLAY_RIGHT = INPUT_RIGHT,
+	REPLAY_DOWN = INPUT_DOWN,
+	REPLAY_ROTATE = INPUT_ROTATE,
+	REPLAY_DROP = INPUT_DROP,
+	REPLAY_GRAVITY,
+	REPLAY_NUM_CALLS
+
+} ReplayCall;
+
+/**
+ * A replay being recorded in memory: its header followed by every engine call
+ * made on the game, each a varint of the ticks since the last call shifted
+ * left by three bits and or'ed with the call, so most calls take one byte
+ */
+typedef struct BlocksRecorder {
+
+	uint8_t *data;
+	size_t size;
+	size_t capacity;
+
+	long tick;
+	uint64_t num_calls;
+
+} BlocksRecorder;
+
+/**
+ * A replay file mapped into memory, its header and footer decoded. The footer
+ * holds the number of calls and ticks recorded and the results the game ended
+ * on, so a playback can be checked against them.
+ */
+typedef struct BlocksReplay {
+
+	const uint8_t *data;
+	size_t size;
+
+	int width;
+	int height;
+	Randomizer randomizer;
+	int score_multiplier;
+	int tick_rate;
+	uint64_t seed;
+
+	const uint8_t *calls;
+	const uint8_t *calls_end;
+
+	uint64_t num_calls;
+	long ticks;
+	long score;
+	long pieces_placed;
+	long lines_cleared;
+	uint64_t hash;
+
+} BlocksReplay;
+
+/**
+ * Start recording a game created from a seed, before any call has been made
+ * on it, ticking tick_rate times a second
+ */
+BlocksRecorder *blocksNewRecorder(const BlocksGame *game, uint64_t seed, int tick_rate);
+
+/**
+ * Record an engine call made in a tick, ticks must not go backwards
+ */
+void blocksRecordCall(BlocksRecorder *recorder, long tick, ReplayCall call);
+
+/**
+ * Write a recording to a file with the game's current results as of the tick
+ * of its last call, returning false on failure. Recording can carry on afterwards.
+ */
+bool blocksSaveReplay(const BlocksRecorder *recorder, const BlocksGame *game, const char *path);
+
+/**
+ * Free a recorder
+ */
+void blocksFreeRecorder(BlocksRecorder *recorder);
+
+/**
+ * Map a replay file into memory, returning NULL if it can't be read or isn't a replay
+ */
+BlocksReplay *blocksOpenReplay(const char *path);
+
+/**
+ * Simulate a replay from its seed as fast as possible, returning the game as
+ * it ended (to be freed with blocksFreeGame), or NULL if the calls are corrupt
+ */
+BlocksGame *blocksPlayReplay(const BlocksReplay *replay);
+
+/**
+ * Check a game played from a replay ended on the replay's recorded results
+ */
+bool blocksVerifyReplay(const BlocksReplay *replay, const BlocksGame *game);
+
+/**
+ * Unmap and free a replay
+ */
+void blocksCloseReplay(BlocksReplay *replay);
+
+/**
+ * Get a 64 bit FNV-1a hash of the locked blocks of a game
+ */
+uint64_t blocksBoardHash(const BlocksGame *game);
+
+#endif /* _BLOCKSREPLAY_H */
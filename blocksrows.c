@@ -0,0 +1,241 @@
+/**
+ * blocksrows.c
+ *
+ * Kernels over the multi-word rows of wide Blocks games, with AVX2 and SSE2
+ * versions picked at runtime and a scalar fallback
+ *
+ * @author Timothy Cheeseman
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define ROWS_X86
+#include <immintrin.h>
+#endif
+
+#include "blocks.h"
+
+/**
+ * Print an error to stderr and exit with EXIT_FAILURE
+ */
+static void rowsError(const char *message);
+
+/**
+ * Compact rows [top, bottom) of a game bottom up, skipping full ones, then move
+ * the rows above down over the cleared ones and empty the top rows, returning
+ * the number cleared. Inlined into each version with its own full row check
+ * and row copy.
+ */
+static inline __attribute__((always_inline)) int rowsCompact(BlocksRow *rows, int words, int top, int bottom, BlocksRow last,
+                                                            bool (*full)(const BlocksRow *, int, BlocksRow),
+                                                            void (*copy)(BlocksRow *, const BlocksRow *, int))
+{
+	int i;
+	int cleared = 0;
+	int write = bottom - 1;
+
+	for (i = bottom - 1; i >= top; i--)
+	{
+		if(full(rows + (size_t) i * words, words, last))
+			cleared++;
+		else if(write-- != i)
+			copy(rows + (size_t) (write + 1) * words, rows + (size_t) i * words, words);
+	}
+
+	if(cleared)
+	{
+		memmove(rows + (size_t) cleared * words, rows, (size_t) top * words * sizeof(BlocksRow));
+		memset(rows, 0, (size_t) cleared * words * sizeof(BlocksRow));
+	}
+
+	return cleared;
+}
+
+static bool rowsFullScalar(const BlocksRow *row, int words, BlocksRow last)
+{
+	int i;
+
+	for (i = 0; i < words - 1; i++)
+		if(row[i] != ~(BlocksRow) 0)
+			return false;
+
+	return row[words - 1] == last;
+}
+
+static bool rowsEmptyScalar(const BlocksRow *row, int words)
+{
+	int i;
+	BlocksRow any = 0;
+
+	for (i = 0; i < words; i++)
+		any |= row[i];
+
+	return !any;
+}
+
+static void rowsCopyScalar(BlocksRow *to, const BlocksRow *from, int words)
+{
+	int i;
+
+	for (i = 0; i < words; i++)
+		to[i] = from[i];
+}
+
+static int rowsCompactScalar(BlocksRow *rows, int words, int top, int bottom, BlocksRow last)
+{
+	return rowsCompact(rows, words, top, bottom, last, rowsFullScalar, rowsCopyScalar);
+}
+
+static const BlocksRowKernels RowsScalar = {"scalar", rowsFullScalar, rowsEmptyScalar, rowsCompactScalar};
+
+#ifdef ROWS_X86
+
+// every word but the last must be all ones, checked two or four words at a time
+
+__attribute__((target("sse2")))
+static bool rowsFullSse2(const BlocksRow *row, int words, BlocksRow last)
+{
+	int i = 0;
+	__m128i ones = _mm_set1_epi32(-1);
+
+	for (; i + 2 < words; i += 2)
+		if(_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *) (row + i)), ones)) != 0xffff)
+			return false;
+
+	for (; i < words - 1; i++)
+		if(row[i] != ~(BlocksRow) 0)
+			return false;
+
+	return row[words - 1] == last;
+}
+
+__attribute__((target("sse2")))
+static bool rowsEmptySse2(const BlocksRow *row, int words)
+{
+	int i = 0;
+	__m128i any = _mm_setzero_si128();
+
+	for (; i + 2 <= words; i += 2)
+		any = _mm_or_si128(any, _mm_loadu_si128((const __m128i *) (row + i)));
+
+	return _mm_movemask_epi8(_mm_cmpeq_epi32(any, _mm_setzero_si128())) == 0xffff && (i == words || !row[i]);
+}
+
+__attribute__((target("sse2")))
+static void rowsCopySse2(BlocksRow *to, const BlocksRow *from, int words)
+{
+	int i = 0;
+
+	for (; i + 2 <= words; i += 2)
+		_mm_storeu_si128((__m128i *) (to + i), _mm_loadu_si128((const __m128i *) (from + i)));
+
+	for (; i < words; i++)
+		to[i] = from[i];
+}
+
+__attribute__((target("sse2")))
+static int rowsCompactSse2(BlocksRow *rows, int words, int top, int bottom, BlocksRow last)
+{
+	return rowsCompact(rows, words, top, bottom, last, rowsFullSse2, rowsCopySse2);
+}
+
+__attribute__((target("avx2")))
+static bool rowsFullAvx2(const BlocksRow *row, int words, BlocksRow last)
+{
+	int i = 0;
+	__m256i ones = _mm256_set1_epi64x(-1);
+
+	for (; i + 4 < words; i += 4)
+		if(!_mm256_testc_si256(_mm256_loadu_si256((const __m256i *) (row + i)), ones))
+			return false;
+
+	for (; i < words - 1; i++)
+		if(row[i] != ~(BlocksRow) 0)
+			return false;
+
+	return row[words - 1] == last;
+}
+
+__attribute__((target("avx2")))
+static bool rowsEmptyAvx2(const BlocksRow *row, int words)
+{
+	int i = 0;
+
+	for (; i + 4 <= words; i += 4)
+	{
+		__m256i word = _mm256_loadu_si256((const __m256i *) (row + i));
+
+		if(!_mm256_testz_si256(word, word))
+			return false;
+	}
+
+	for (; i < words; i++)
+		if(row[i])
+			return false;
+
+	return true;
+}
+
+__attribute__((target("avx2")))
+static void rowsCopyAvx2(BlocksRow *to, const BlocksRow *from, int words)
+{
+	int i = 0;
+
+	for (; i + 4 <= words; i += 4)
+		_mm256_storeu_si256((__m256i *) (to + i), _mm256_loadu_si256((const __m256i *) (from + i)));
+
+	for (; i < words; i++)
+		to[i] = from[i];
+}
+
+__attribute__((target("avx2")))
+static int rowsCompactAvx2(BlocksRow *rows, int words, int top, int bottom, BlocksRow last)
+{
+	return rowsCompact(rows, words, top, bottom, last, rowsFullAvx2, rowsCopyAvx2);
+}
+
+static const BlocksRowKernels RowsSse2 = {"sse2", rowsFullSse2, rowsEmptySse2, rowsCompactSse2};
+static const BlocksRowKernels RowsAvx2 = {"avx2", rowsFullAvx2, rowsEmptyAvx2, rowsCompactAvx2};
+
+#endif /* ROWS_X86 */
+
+static void rowsError(const char *message)
+{
+	fprintf(stderr, "BLOCKS3D: %s\n", message);
+	exit(EXIT_FAILURE);
+}
+
+const BlocksRowKernels *blocksRowKernels()
+{
+	const char *name = getenv("BLOCKS3D_ROW_KERNELS");
+
+	if(name && !*name)
+		name = NULL;
+
+	// kernels asked for by hand must exist and run on this CPU, so a benchmark
+	// never reports different kernels to the ones it was asked for
+
+	if(name && strcmp(name, "avx2") && strcmp(name, "sse2") && strcmp(name, "scalar"))
+		rowsError("BLOCKS3D_ROW_KERNELS must be avx2, sse2 or scalar.");
+
+	if(name && !strcmp(name, "scalar"))
+		return &RowsScalar;
+
+#ifdef ROWS_X86
+	__builtin_cpu_init();
+
+	if((!name || !strcmp(name, "avx2")) && __builtin_cpu_supports("avx2"))
+		return &RowsAvx2;
+
+	if((!name || !strcmp(name, "sse2")) && __builtin_cpu_supports("sse2"))
+		return &RowsSse2;
+#endif
+
+	if(name)
+		rowsError("The row kernels named by BLOCKS3D_ROW_KERNELS aren't supported by this CPU.");
+
+	return &RowsScalar;
+}
@@ -0,0 +1,493 @@
+/**
+ * blockssim.c
+ *
+ * Headless Blocks simulator for measuring engine throughput
+ *
+ * @author Timothy Cheeseman
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "blocks.h"
+#include "blocksai.h"
+
+/**
+ * Simulation policy
+ */
+typedef enum Policy {
+
+	POLICY_RANDOM,
+	POLICY_SCRIPT,
+	POLICY_AI
+
+} Policy;
+
+/**
+ * Settings shared by every game of a batch
+ */
+typedef struct SimBatch {
+
+	int games;
+	int width;
+	int height;
+	long max_moves;
+	Policy policy;
+	const char *script;
+	int beam_width;
+	uint64_t seed;
+	Randomizer randomizer;
+
+	int num_workers;
+	struct SimWorker *workers;
+
+} SimBatch;
+
+/**
+ * A worker thread with its own queue of games and its own results, kept on
+ * separate cache lines so workers never write to shared memory while playing
+ */
+typedef struct SimWorker {
+
+	_Alignas(64) _Atomic uint64_t games;
+
+	SimBatch *batch;
+	pthread_t thread;
+	int id;
+	BlocksAI *ai;
+
+	long games_played;
+	long pieces;
+	long lines;
+	long score;
+	long steals;
+	double busy;
+
+} SimWorker;
+
+/**
+ * Print usage information to stderr and exit with EXIT_FAILURE
+ */
+static void simUsage(const char *program);
+
+/**
+ * Get the current value of the monotonic clock in seconds
+ */
+static double simTime();
+
+/**
+ * Worker thread entry point, plays games until there are none left to take or steal
+ */
+static void *simWorker(void *data);
+
+/**
+ * Take the next game from the front of a worker's own queue
+ */
+static bool simTakeGame(SimWorker *worker, int *game);
+
+/**
+ * Steal the back half of another worker's queue into an empty queue
+ */
+static bool simStealGames(SimWorker *worker);
+
+/**
+ * Play a single game of a batch and record its results
+ */
+static void simPlayGame(SimWorker *worker, int index);
+
+/**
+ * Play a game by dropping every piece with a random rotation into a random column
+ */
+static void simPlayRandom(BlocksGame *game, BlocksRandom *random, long max_moves);
+
+/**
+ * Play a game by repeating a script of keyboard controls (w, a, s, d and space)
+ */
+static void simPlayScript(BlocksGame *game, const char *script, long max_moves);
+
+/**
+ * Play a game with the computer player, placing each piece where its search chooses
+ */
+static void simPlayAI(BlocksGame *game, BlocksAI *ai, long max_moves);
+
+/**
+ * Pack the half open range of game indices [first, end) of a worker's queue
+ */
+static inline uint64_t simRange(uint32_t first, uint32_t end)
+{
+	return (uint64_t) end << 32 | first;
+}
+
+int main(int argc, char *argv[])
+{
+	int i, option;
+
+	SimBatch batch = {
+		.games = 1000,
+		.width = BLOCKS_STANDARD_WIDTH,
+		.height = BLOCKS_STANDARD_HEIGHT,
+		.max_moves = 1000000,
+		.policy = POLICY_RANDOM,
+		.script = NULL,
+		.beam_width = 0,
+		.seed = time(NULL),
+		.randomizer = RANDOMIZER_UNIFORM,
+		.num_workers = sysconf(_SC_NPROCESSORS_ONLN)
+	};
+
+	long pieces = 0;
+	long lines = 0;
+	long score = 0;
+
+	while((option = getopt(argc, argv, "n:w:h:m:s:a:S:bj:")) != -1)
+	{
+		switch(option)
+		{
+			case 'n':
+				batch.games = atoi(optarg);
+				break;
+			case 'w':
+				batch.width = atoi(optarg);
+				break;
+			case 'h':
+				batch.height = atoi(optarg);
+				break;
+			case 'm':
+				batch.max_moves = atol(optarg);
+				break;
+			case 's':
+				batch.policy = POLICY_SCRIPT;
+				batch.script = optarg;
+				break;
+			case 'a':
+				batch.policy = POLICY_AI;
+				batch.beam_width = atoi(optarg);
+				break;
+			case 'S':
+				batch.seed = strtoull(optarg, NULL, 0);
+				break;
+			case 'b':
+				batch.randomizer = RANDOMIZER_BAG;
+				break;
+			case 'j':
+				batch.num_workers = atoi(optarg);
+				break;
+			default:
+				simUsage(argv[0]);
+		}
+	}
+
+	if(batch.games <= 0 || batch.width < BLOCKS_PIECE_SIZE || batch.width > BLOCKS_MAX_WIDTH || batch.height <= 0)
+		simUsage(argv[0]);
+
+	if(batch.policy == POLICY_SCRIPT && !*batch.script)
+		simUsage(argv[0]);
+
+	if(batch.policy == POLICY_AI && (batch.beam_width <= 0 || batch.width > BLOCKS_NARROW_WIDTH))
+		simUsage(argv[0]);
+
+	if(batch.num_workers <= 0)
+		simUsage(argv[0]);
+
+	if(batch.num_workers > batch.games)
+		batch.num_workers = batch.games;
+
+	batch.workers = aligned_alloc(_Alignof(SimWorker), batch.num_workers * sizeof(SimWorker));
+
+	if(!batch.workers)
+	{
+		fprintf(stderr, "BLOCKS3D: Error allocating memory for the simulation workers.\n");
+		return EXIT_FAILURE;
+	}
+
+	// split the games evenly, workers that finish early steal from the others
+
+	for(i = 0; i < batch.num_workers; i++)
+	{
+		SimWorker *worker = &batch.workers[i];
+
+		memset(worker, 0, sizeof(SimWorker));
+		worker->batch = &batch;
+		worker->id = i;
+
+		atomic_init(&worker->games, simRange((long) batch.games * i / batch.num_workers,
+		                                     (long) batch.games * (i + 1) / batch.num_workers));
+	}
+
+	double start = simTime();
+
+	for(i = 0; i < batch.num_workers; i++)
+	{
+		if(pthread_create(&batch.workers[i].thread, NULL, simWorker, &batch.workers[i]))
+		{
+			fprintf(stderr, "BLOCKS3D: Error creating a simulation thread.\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	for(i = 0; i < batch.num_workers; i++)
+		pthread_join(batch.workers[i].thread, NULL);
+
+	double elapsed = simTime() - start;
+
+	for(i = 0; i < batch.num_workers; i++)
+	{
+		pieces += batch.workers[i].pieces;
+		lines += batch.workers[i].lines;
+		score += batch.workers[i].score;
+	}
+
+	printf("games:      %d\n", batch.games);
+	printf("board:      %dx%d\n", batch.width, batch.height);
+	if(batch.policy == POLICY_AI)
+		printf("policy:     ai (beam width %d)\n", batch.beam_width);
+	else
+		printf("policy:     %s\n", batch.policy == POLICY_RANDOM ? "random" : batch.script);
+
+	printf("randomizer: %s\n", batch.randomizer == RANDOMIZER_BAG ? "7-bag" : "uniform");
+	printf("seed:       %llu\n", (unsigned long long) batch.seed);
+	printf("threads:    %d\n", batch.num_workers);
+	printf("pieces:     %ld\n", pieces);
+	printf("lines:      %ld\n", lines);
+	printf("mean score: %.1f\n", (double) score / batch.games);
+	printf("time:       %.3f s\n", elapsed);
+	printf("games/sec:  %.0f\n", batch.games / elapsed);
+	printf("pieces/sec: %.0f\n", pieces / elapsed);
+	printf("lines/sec:  %.0f\n", lines / elapsed);
+
+	printf("\nthread      games     steals  utilization\n");
+
+	for(i = 0; i < batch.num_workers; i++)
+	{
+		SimWorker *worker = &batch.workers[i];
+
+		printf("%6d %10ld %10ld %11.1f%%\n", worker->id, worker->games_played, worker->steals,
+		       100.0 * worker->busy / elapsed);
+	}
+
+	free(batch.workers);
+
+	return EXIT_SUCCESS;
+}
+
+static void simUsage(const char *program)
+{
+	fprintf(stderr, "Usage: %s [-n games] [-w width] [-h height] [-m max moves per game] [-s script] [-a beam width] [-S seed] [-b] [-j threads]\n", program);
+	fprintf(stderr, "Without a script every piece is dropped with a random rotation into a random column.\n");
+	fprintf(stderr, "A script is a sequence of the keyboard controls w, a, s, d and space, repeated until game over.\n");
+	fprintf(stderr, "With -a every piece is placed by the computer player searching with the given beam width.\n");
+	fprintf(stderr, "Game i is seeded with seed + i, -b deals pieces from a 7-bag instead of uniformly.\n");
+	fprintf(stderr, "Games are played on all cores unless a number of threads is given.\n");
+	exit(EXIT_FAILURE);
+}
+
+static double simTime()
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+static void *simWorker(void *data)
+{
+	SimWorker *worker = data;
+	int index;
+
+	// games are already played in parallel, so each computer player searches
+	// on its worker's thread alone
+
+	if(worker->batch->policy == POLICY_AI)
+		worker->ai = blocksNewAI(worker->batch->width, worker->batch->height, worker->batch->beam_width, 1);
+
+	for(;;)
+	{
+		if(simTakeGame(worker, &index))
+		{
+			double start = simTime();
+
+			simPlayGame(worker, index);
+			worker->busy += simTime() - start;
+		}
+		else if(!simStealGames(worker))
+			break;
+	}
+
+	if(worker->ai)
+		blocksFreeAI(worker->ai);
+
+	return NULL;
+}
+
+static bool simTakeGame(SimWorker *worker, int *game)
+{
+	uint64_t range = atomic_load(&worker->games);
+	uint32_t first, end;
+
+	do
+	{
+		first = (uint32_t) range;
+		end = range >> 32;
+
+		if(first >= end)
+			return false;
+	}
+	while(!atomic_compare_exchange_weak(&worker->games, &range, simRange(first + 1, end)));
+
+	*game = first;
+
+	return true;
+}
+
+static bool simStealGames(SimWorker *worker)
+{
+	int i;
+	SimBatch *batch = worker->batch;
+
+	// a queue only grows when its own thread refills it with games it stole,
+	// which that thread then plays, so once every other queue has been seen
+	// empty the remaining games all sit with threads that will play them
+
+	for(i = 1; i < batch->num_workers; i++)
+	{
+		SimWorker *victim = &batch->workers[(worker->id + i) % batch->num_workers];
+		uint64_t range = atomic_load(&victim->games);
+		uint32_t first, middle, end;
+
+		do
+		{
+			first = (uint32_t) range;
+			end = range >> 32;
+
+			if(first >= end)
+				break;
+
+			middle = first + (end - first) / 2;
+		}
+		while(!atomic_compare_exchange_weak(&victim->games, &range, simRange(first, middle)));
+
+		if(first < end)
+		{
+			atomic_store(&worker->games, simRange(middle, end));
+			worker->steals++;
+
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static void simPlayGame(SimWorker *worker, int index)
+{
+	SimBatch *batch = worker->batch;
+	BlocksGame *game = blocksNewGameSeeded(batch->width, batch->height, batch->seed + index, batch->randomizer);
+
+	if(batch->policy == POLICY_RANDOM)
+	{
+		BlocksRandom random;
+
+		// seed the policy differently from the game so the two streams are unrelated
+
+		blocksSeedRandom(&random, ~(batch->seed + index));
+		simPlayRandom(game, &random, batch->max_moves);
+	}
+	else if(batch->policy == POLICY_AI)
+		simPlayAI(game, worker->ai, batch->max_moves);
+	else
+		simPlayScript(game, batch->script, batch->max_moves);
+
+	worker->games_played++;
+	worker->pieces += game->pieces_placed;
+	worker->lines += game->lines_cleared;
+	worker->score += game->score;
+
+	blocksFreeGame(game);
+}
+
+static void simPlayRandom(BlocksGame *game, BlocksRandom *random, long max_moves)
+{
+	int i;
+	long moves = 0;
+
+	while(!game->game_over && moves < max_moves)
+	{
+		int rotations = blocksRandomBelow(random, BLOCKS_NUM_ROTATIONS);
+		int column = blocksRandomBelow(random, game->width);
+
+		for(i = 0; i < rotations; i++)
+			blocksRotatePiece(game);
+
+		while(game->current_piece->position[0] > column && moves++ < max_moves)
+		{
+			int x = game->current_piece->position[0];
+
+			blocksMovePiece(game, DIRECTION_LEFT);
+
+			if(game->current_piece->position[0] == x)
+				break;
+		}
+
+		while(game->current_piece->position[0] < column && moves++ < max_moves)
+		{
+			int x = game->current_piece->position[0];
+
+			blocksMovePiece(game, DIRECTION_RIGHT);
+
+			if(game->current_piece->position[0] == x)
+				break;
+		}
+
+		blocksDropPiece(game);
+		moves += rotations + 1;
+	}
+}
+
+static void simPlayScript(BlocksGame *game, const char *script, long max_moves)
+{
+	long moves;
+	const char *key = script;
+
+	for(moves = 0; !game->game_over && moves < max_moves; moves++)
+	{
+		switch(*key)
+		{
+			case 'w':
+			case 'W':
+				blocksRotatePiece(game);
+				break;
+			case 'a':
+			case 'A':
+				blocksMovePiece(game, DIRECTION_LEFT);
+				break;
+			case 's':
+			case 'S':
+				blocksMovePiece(game, DIRECTION_DOWN);
+				break;
+			case 'd':
+			case 'D':
+				blocksMovePiece(game, DIRECTION_RIGHT);
+				break;
+			case ' ':
+				blocksDropPiece(game);
+				break;
+		}
+
+		if(!*++key)
+			key = script;
+	}
+}
+
+static void simPlayAI(BlocksGame *game, BlocksAI *ai, long max_moves)
+{
+	long moves = 0;
+
+	while(!game->game_over && moves < max_moves)
+		moves += blocksAIPlacePiece(ai, game);
+}
@@ -0,0 +1,359 @@
+/**
+ * blockswell.c
+ *
+ * 3D Blocks game in a voxel well for the Blocks library
+ *
+ * @author Timothy Cheeseman
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "blockswell.h"
+
+static const Color PolycubeColors[] = {
+	{0, 255, 255}, // cyan
+	{255, 255, 0}, // yellow
+	{255, 0, 255}, // magenta
+	{255, 165, 0}, // orange
+	{0, 255, 0}, // green
+	{255, 0, 0}, // red
+	{0, 0, 255}, // blue
+	{255, 255, 255} // white
+};
+
+/**
+ * The cubes of every polycube type as it spawns, lying flat where it can
+ */
+static const int8_t PolycubeCells[BLOCKS_NUM_POLYCUBES][BLOCKS_POLYCUBE_SIZE][3] = {
+	{{0, 0, 0}, {1, 0, 0}, {2, 0, 0}, {3, 0, 0}}, // I
+	{{0, 0, 0}, {1, 0, 0}, {0, 0, 1}, {1, 0, 1}}, // O
+	{{0, 0, 0}, {1, 0, 0}, {2, 0, 0}, {1, 0, 1}}, // T
+	{{0, 0, 0}, {1, 0, 0}, {2, 0, 0}, {0, 0, 1}}, // L
+	{{0, 0, 0}, {1, 0, 0}, {1, 0, 1}, {2, 0, 1}}, // S
+	{{0, 0, 0}, {1, 0, 0}, {1, 1, 0}, {1, 1, 1}}, // right screw
+	{{0, 0, 1}, {1, 0, 1}, {1, 1, 1}, {1, 1, 0}}, // left screw
+	{{0, 0, 0}, {1, 0, 0}, {0, 0, 1}, {0, 1, 0}} // branch
+};
+
+/**
+ * Print an error to stderr and exit with EXIT_FAILURE
+ */
+static void wellError(const char *message);
+
+/**
+ * Move a polycube's cubes to the corner of their bounding box and rebuild its
+ * size and layer masks for a well of a given width
+ */
+static void wellShapePiece(Polycube *piece, int width);
+
+/**
+ * Spawn a random polycube at the top of the well
+ */
+static void wellSpawnPiece(BlocksWell *well, Polycube *piece);
+
+/**
+ * Merge the current piece into the well's layers, clear any full ones and cycle the pieces
+ */
+static void wellNextPiece(BlocksWell *well);
+
+/**
+ * Check if there is a collision between the current piece and the well
+ */
+static bool wellCollision(const BlocksWell *well);
+
+static void wellError(const char *message)
+{
+	fprintf(stderr, "BLOCKS3D: %s\n", message);
+	exit(EXIT_FAILURE);
+}
+
+BlocksWell *blocksNewWell(int width, int depth, int height, uint64_t seed)
+{
+	if(width < BLOCKS_POLYCUBE_SIZE || depth < BLOCKS_POLYCUBE_SIZE || width * depth > BLOCKS_MAX_WELL_AREA)
+		wellError("Invalid size for a new Blocks3D well.");
+
+	if(height <= 0)
+		wellError("Invalid height for a new Blocks3D well.");
+
+	size_t size = sizeof(BlocksWell) + (size_t) (height + BLOCKS_BUFFER_HEIGHT) * sizeof(BlocksLayer);
+	BlocksWell *well = calloc(1, size);
+
+	if(!well)
+		wellError("Error allocating memory for a new Blocks3D well.");
+
+	well->size = size;
+	well->width = width;
+	well->depth = depth;
+	well->height = height + BLOCKS_BUFFER_HEIGHT;
+
+	well->layers = (BlocksLayer *) (well + 1);
+	well->full_layer = width * depth == BLOCKS_MAX_WELL_AREA ? ~(BlocksLayer) 0 : ((BlocksLayer) 1 << (width * depth)) - 1;
+
+	well->current_piece = &well->pieces[0];
+	well->next_piece = &well->pieces[1];
+
+	blocksSeedRandom(&well->random, seed);
+
+	wellSpawnPiece(well, well->current_piece);
+	wellSpawnPiece(well, well->next_piece);
+
+	well->score = 0;
+	well->score_multiplier = 1;
+	well->game_over = false;
+
+	well->pieces_placed = 0;
+	well->layers_cleared = 0;
+
+	well->dirty = DIRTY_ALL;
+
+	return well;
+}
+
+static void wellShapePiece(Polycube *piece, int width)
+{
+	int i, axis;
+	int low[3] = {BLOCKS_POLYCUBE_SIZE, BLOCKS_POLYCUBE_SIZE, BLOCKS_POLYCUBE_SIZE};
+
+	for (i = 0; i < BLOCKS_POLYCUBE_SIZE; i++)
+		for (axis = 0; axis < 3; axis++)
+			if(piece->cells[i][axis] < low[axis])
+				low[axis] = piece->cells[i][axis];
+
+	for (axis = 0; axis < 3; axis++)
+		piece->size[axis] = 0;
+
+	for (i = 0; i < BLOCKS_POLYCUBE_SIZE; i++)
+		piece->mask[i] = 0;
+
+	for (i = 0; i < BLOCKS_POLYCUBE_SIZE; i++)
+	{
+		int8_t *cell = piece->cells[i];
+
+		for (axis = 0; axis < 3; axis++)
+		{
+			cell[axis] -= low[axis];
+
+			if(cell[axis] + 1 > piece->size[axis])
+				piece->size[axis] = cell[axis] + 1;
+		}
+
+		piece->mask[cell[AXIS_Y]] |= (BlocksLayer) 1 << (cell[AXIS_Z] * width + cell[AXIS_X]);
+	}
+}
+
+static void wellSpawnPiece(BlocksWell *well, Polycube *piece)
+{
+	enum PolycubeType type = blocksRandomBelow(&well->random, BLOCKS_NUM_POLYCUBES);
+
+	piece->type = type;
+	piece->color = PolycubeColors[type];
+
+	memcpy(piece->cells, PolycubeCells[type], sizeof(piece->cells));
+	wellShapePiece(piece, well->width);
+
+	piece->position[AXIS_X] = (well->width - piece->size[AXIS_X]) / 2;
+	piece->position[AXIS_Y] = BLOCKS_BUFFER_HEIGHT - piece->size[AXIS_Y];
+	piece->position[AXIS_Z] = (well->depth - piece->size[AXIS_Z]) / 2;
+}
+
+void blocksWellMovePiece(BlocksWell *well, WellDirection direction)
+{
+	static const int Steps[][3] = {
+		{-1, 0, 0}, // left
+		{1, 0, 0}, // right
+		{0, 0, -1}, // back
+		{0, 0, 1}, // forward
+		{0, 1, 0} // down
+	};
+
+	int axis;
+	Polycube *piece = well->current_piece;
+
+	if(well->game_over)
+		return;
+
+	for (axis = 0; axis < 3; axis++)
+		piece->position[axis] += Steps[direction][axis];
+
+	if(!wellCollision(well))
+	{
+		well->dirty |= DIRTY_PIECE;
+		return;
+	}
+
+	for (axis = 0; axis < 3; axis++)
+		piece->position[axis] -= Steps[direction][axis];
+
+	if(direction == WELL_DOWN)
+		wellNextPiece(well);
+}
+
+void blocksWellRotatePiece(BlocksWell *well, Axis axis)
+{
+	int i;
+	Polycube *piece = well->current_piece;
+	Polycube old_piece = *piece;
+
+	if(well->game_over)
+		return;
+
+	// a quarter turn takes the two other axes (u, v) to (-v, u), and the
+	// piece is then moved back into the corner of its bounding box
+
+	int u = (axis + 1) % 3;
+	int v = (axis + 2) % 3;
+
+	for (i = 0; i < BLOCKS_POLYCUBE_SIZE; i++)
+	{
+		int8_t cell_u = piece->cells[i][u];
+
+		piece->cells[i][u] = -piece->cells[i][v];
+		piece->cells[i][v] = cell_u;
+	}
+
+	wellShapePiece(piece, well->width);
+
+	// if rotation causes a collision, undo it
+
+	if(wellCollision(well))
+		*piece = old_piece;
+	else
+		well->dirty |= DIRTY_PIECE;
+}
+
+void blocksWellDropPiece(BlocksWell *well)
+{
+	if(well->game_over)
+		return;
+
+	well->current_piece->position[AXIS_Y] = blocksWellLandingLayer(well);
+
+	wellNextPiece(well);
+}
+
+void blocksWellApplyInput(BlocksWell *well, WellInput input)
+{
+	switch (input)
+	{
+		case WELL_INPUT_LEFT:
+			blocksWellMovePiece(well, WELL_LEFT);
+			break;
+		case WELL_INPUT_RIGHT:
+			blocksWellMovePiece(well, WELL_RIGHT);
+			break;
+		case WELL_INPUT_BACK:
+			blocksWellMovePiece(well, WELL_BACK);
+			break;
+		case WELL_INPUT_FORWARD:
+			blocksWellMovePiece(well, WELL_FORWARD);
+			break;
+		case WELL_INPUT_DOWN:
+			blocksWellMovePiece(well, WELL_DOWN);
+			break;
+		case WELL_INPUT_ROTATE_X:
+			blocksWellRotatePiece(well, AXIS_X);
+			break;
+		case WELL_INPUT_ROTATE_Y:
+			blocksWellRotatePiece(well, AXIS_Y);
+			break;
+		case WELL_INPUT_ROTATE_Z:
+			blocksWellRotatePiece(well, AXIS_Z);
+			break;
+		case WELL_INPUT_DROP:
+			blocksWellDropPiece(well);
+			break;
+	}
+}
+
+static void wellNextPiece(BlocksWell *well)
+{
+	int i;
+	int cleared = 0;
+	Polycube *piece = well->current_piece;
+	int top = piece->position[AXIS_Y];
+	int bottom = top + piece->size[AXIS_Y];
+	int shift = piece->position[AXIS_Z] * well->width + piece->position[AXIS_X];
+
+	// merge old piece into the well's layers
+
+	for (i = 0; i < piece->size[AXIS_Y]; i++)
+		well->layers[top + i] |= piece->mask[i] << shift;
+
+	// cycle pieces
+
+	*well->current_piece = *well->next_piece;
+	wellSpawnPiece(well, well->next_piece);
+
+	well->dirty |= DIRTY_BOARD | DIRTY_PIECE | DIRTY_NEXT | DIRTY_SCORE;
+
+	well->score += well->score_multiplier * 100;
+	well->pieces_placed++;
+
+	// only the layers touched by the piece can have become full, so compact
+	// them as rows are in a blocks game, then move the layers above down
+
+	int write = bottom - 1;
+
+	for (i = bottom - 1; i >= top; i--)
+	{
+		if(well->layers[i] == well->full_layer)
+			cleared++;
+		else
+			well->layers[write--] = well->layers[i];
+	}
+
+	if(cleared)
+	{
+		memmove(well->layers + cleared, well->layers, top * sizeof(BlocksLayer));
+		memset(well->layers, 0, cleared * sizeof(BlocksLayer));
+
+		// a layer is worth more than a row, having more cells
+
+		well->score += well->score_multiplier * 1000 * cleared * well->depth;
+		well->layers_cleared += cleared;
+	}
+
+	// check for game over, only the remaining layers of the piece can have
+	// reached the buffer
+
+	for (i = top + cleared; i < bottom && i < BLOCKS_BUFFER_HEIGHT; i++)
+		if(well->layers[i])
+			well->game_over = true;
+
+	if(well->game_over)
+		well->dirty |= DIRTY_GAME_OVER;
+}
+
+unsigned int blocksWellTakeDirty(BlocksWell *well)
+{
+	unsigned int dirty = well->dirty;
+
+	well->dirty = 0;
+
+	return dirty;
+}
+
+int blocksWellLandingLayer(const BlocksWell *well)
+{
+	const Polycube *piece = well->current_piece;
+	int y = piece->position[AXIS_Y];
+
+	while(!blocksWellCollision(well, piece, piece->position[AXIS_X], y + 1, piece->position[AXIS_Z]))
+		y++;
+
+	return y;
+}
+
+static bool wellCollision(const BlocksWell *well)
+{
+	const Polycube *piece = well->current_piece;
+
+	return blocksWellCollision(well, piece, piece->position[AXIS_X], piece->position[AXIS_Y], piece->position[AXIS_Z]);
+}
+
+void blocksFreeWell(BlocksWell *well)
+{
+	free(well);
+}
@@ -0,0 +1,225 @@
+/**
+ * blockswell.h
+ *
+ * 3D Blocks game in a voxel well for the Blocks library
+ *
+ * @author Timothy Cheeseman
+ */
+
+#ifndef _BLOCKSWELL_H
+#define _BLOCKSWELL_H
+
+#include "blocks.h"
+
+/**
+ * A layer bitmask, bit z * width + x set if the cell in column x and row z of
+ * the layer is occupied
+ */
+typedef uint64_t BlocksLayer;
+
+/**
+ * The most cells a layer of a well can have, so it fits in a single word
+ */
+#define BLOCKS_MAX_WELL_AREA 64
+
+/**
+ * The number of cubes in a polycube
+ */
+#define BLOCKS_POLYCUBE_SIZE 4
+
+/**
+ * Polycube type enum, the eight free tetracubes
+ */
+enum PolycubeType {
+
+	POLYCUBE_I = 0,
+	POLYCUBE_O = 1,
+	POLYCUBE_T = 2,
+	POLYCUBE_L = 3,
+	POLYCUBE_S = 4,
+	POLYCUBE_RIGHT_SCREW = 5,
+	POLYCUBE_LEFT_SCREW = 6,
+	POLYCUBE_BRANCH = 7
+};
+
+/**
+ * The number of polycube types
+ */
+#define BLOCKS_NUM_POLYCUBES 8
+
+/**
+ * Axis enum, y pointing down the well as rows do in a blocks game
+ */
+typedef enum Axis {
+
+	AXIS_X,
+	AXIS_Y,
+	AXIS_Z
+
+} Axis;
+
+/**
+ * Polycube representation, its cubes as x, y, z offsets from the corner of its
+ * bounding box, the size of the box, and each of its layers top down as a
+ * layer bitmask of the well it is in, so it is checked against each layer of
+ * the well with a shift and an and
+ */
+typedef struct Polycube {
+
+	Color color;
+	enum PolycubeType type;
+	int8_t cells[BLOCKS_POLYCUBE_SIZE][3];
+	int size[3];
+	BlocksLayer mask[BLOCKS_POLYCUBE_SIZE];
+	int position[3];
+
+} Polycube;
+
+/**
+ * 3D blocks game representation, a well width cells wide, depth cells deep and
+ * height layers high with a buffer above it, stored in a single block of
+ * memory (the well followed by its layers). Layers are numbered from the top,
+ * the first BLOCKS_BUFFER_HEIGHT being the buffer, and a layer is cleared when
+ * all of its cells are filled.
+ */
+typedef struct BlocksWell {
+
+	size_t size;
+
+	int width;
+	int depth;
+	int height;
+
+	Polycube *current_piece;
+	Polycube *next_piece;
+	Polycube pieces[2];
+
+	BlocksLayer *layers;
+	BlocksLayer full_layer;
+
+	long score;
+	int score_multiplier;
+	bool game_over;
+
+	long pieces_placed;
+	long layers_cleared;
+
+	BlocksRandom random;
+
+	unsigned int dirty;
+
+} BlocksWell;
+
+/**
+ * Well direction enum
+ */
+typedef enum WellDirection {
+
+	WELL_LEFT,
+	WELL_RIGHT,
+	WELL_BACK,
+	WELL_FORWARD,
+	WELL_DOWN
+
+} WellDirection;
+
+/**
+ * Player input enum for a well, covering every way the current piece can be moved
+ */
+typedef enum WellInput {
+
+	WELL_INPUT_LEFT,
+	WELL_INPUT_RIGHT,
+	WELL_INPUT_BACK,
+	WELL_INPUT_FORWARD,
+	WELL_INPUT_DOWN,
+	WELL_INPUT_ROTATE_X,
+	WELL_INPUT_ROTATE_Y,
+	WELL_INPUT_ROTATE_Z,
+	WELL_INPUT_DROP
+
+} WellInput;
+
+/**
+ * Create a new well whose pieces are generated from a seed, at least
+ * BLOCKS_POLYCUBE_SIZE cells wide and deep and at most BLOCKS_MAX_WELL_AREA
+ * cells a layer
+ */
+BlocksWell *blocksNewWell(int width, int depth, int height, uint64_t seed);
+
+/**
+ * Attempt to move the current piece in a well, locking it in place if it
+ * can't move down
+ */
+void blocksWellMovePiece(BlocksWell *well, WellDirection direction);
+
+/**
+ * Attempt to rotate the current piece in a well a quarter turn about an axis
+ */
+void blocksWellRotatePiece(BlocksWell *well, Axis axis);
+
+/**
+ * Attempt to drop the current piece in a well
+ */
+void blocksWellDropPiece(BlocksWell *well);
+
+/**
+ * Apply a player input to a well
+ */
+void blocksWellApplyInput(BlocksWell *well, WellInput input);
+
+/**
+ * Get the parts of a well that have changed (BlocksDirty flags) since the
+ * last call, and clear them
+ */
+unsigned int blocksWellTakeDirty(BlocksWell *well);
+
+/**
+ * Get the layer the current piece of a well would land on if dropped
+ */
+int blocksWellLandingLayer(const BlocksWell *well);
+
+/**
+ * Free the memory used by a well
+ */
+void blocksFreeWell(BlocksWell *well);
+
+/**
+ * Check if there is a collision between a polycube at column x, layer y and row
+ * z and the well's layers or bounds
+ */
+static inline bool blocksWellCollision(const BlocksWell *well, const Polycube *piece, int x, int y, int z)
+{
+	int i;
+
+	// check for out of bounds
+
+	if(x < 0 || z < 0)
+		return true;
+
+	if(x + piece->size[AXIS_X] > well->width || z + piece->size[AXIS_Z] > well->depth)
+		return true;
+
+	if(y + piece->size[AXIS_Y] > well->height)
+		return true;
+
+	// check for collisions, a word per layer of the piece
+
+	int shift = z * well->width + x;
+
+	for (i = 0; i < piece->size[AXIS_Y]; i++)
+		if((piece->mask[i] << shift) & well->layers[y + i])
+			return true;
+
+	return false;
+}
+
+/**
+ * Check if the cell at column x, layer y and row z of a well is occupied
+ */
+static inline bool blocksWellCell(const BlocksWell *well, int x, int y, int z)
+{
+	return (well->layers[y] >> (z * well->width + x)) & 1;
+}
+
+#endif /* _BLOCKSWELL_H */